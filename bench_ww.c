@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* bench_ww
+ *
+ * arguments
+ * 1. path of the ww binary to measure (build it without sanitizers, e.g.
+ *    "make ww_bench")
+ * 2. (optional) size of each generated corpus in MB, default 64
+ * 3. (optional) directory to hold the corpora, default bench_corpus
+ *
+ * generates these synthetic corpora (skipped if already present with the right
+ * size, so repeated runs measure the same input):
+ * 1. long_words.txt: words of 40-400 chars, most longer than the column width
+ * 2. whitespace.txt: short words in long runs of mixed whitespace
+ * 3. paragraphs.txt: paragraphs of a few short lines separated by blank lines
+ * 4. one_line.txt: a single line of words with no newline chars
+ * 5. small_files/: 4 KB files adding up to the corpus size
+ *
+ * then runs ww on every corpus for each column width and input strategy and
+ * prints one line per run: input MB/s, read() and write() calls per MB of
+ * input (from /proc/<pid>/io), and peak RSS. The directory corpus is also run
+ * with -j and with --uring. Exits with failure if ww could not be run.
+ */
+
+#define SMALL_FILE_SIZE 4096
+#define MB (1024 * 1024)
+
+const char *corpora[] = {"long_words.txt", "whitespace.txt", "paragraphs.txt",
+    "one_line.txt"};
+const int widths[] = {20, 72, 200};
+const char *modes[][3] = {
+    {"--bufsize", "4096", NULL},
+    {"--bufsize", "65536", NULL},
+    {"--bufsize", "1048576", NULL},
+    {"--mmap", NULL, NULL},
+};
+
+#define CT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+// xorshift PRNG, so every run generates the same corpora
+unsigned long long rng_state = 88172645463325252ULL;
+
+unsigned rng(unsigned n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state % n;
+}
+
+void put_word(FILE *fp, int len)
+{
+    for (int i = 0; i < len; i++) {
+        fputc('a' + rng(26), fp);
+    }
+}
+
+void put_whitespace(FILE *fp, int len)
+{
+    const char ws[] = "  \t\n \r\v\f  ";
+    for (int i = 0; i < len; i++) {
+        fputc(ws[rng(sizeof(ws) - 1)], fp);
+    }
+}
+
+// write roughly size bytes of the named corpus kind to fp
+void generate(FILE *fp, const char *kind, long size)
+{
+    long line_words = 0;
+    while (ftell(fp) < size) {
+        if (!strcmp(kind, "long_words.txt")) {
+            put_word(fp, 40 + rng(360));
+            fputc(rng(8) ? ' ' : '\n', fp);
+        }
+        else if (!strcmp(kind, "whitespace.txt")) {
+            put_word(fp, 1 + rng(8));
+            put_whitespace(fp, 1 + rng(120));
+        }
+        else if (!strcmp(kind, "paragraphs.txt")) {
+            put_word(fp, 1 + rng(10));
+            if (++line_words % 12 == 0) {
+                fputs(rng(4) ? "\n" : "\n\n", fp);
+            }
+            else {
+                fputc(' ', fp);
+            }
+        }
+        else {
+            put_word(fp, 1 + rng(10));
+            fputc(' ', fp);
+        }
+    }
+}
+
+// create path with size bytes of kind unless it already has that size
+int make_corpus(const char *path, const char *kind, long size)
+{
+    struct stat st;
+    FILE *fp;
+    if (stat(path, &st) == 0 && st.st_size >= size) return 0;
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        return -1;
+    }
+    generate(fp, kind, size);
+    fclose(fp);
+    return 0;
+}
+
+int make_small_files(const char *dir, long size)
+{
+    char path[4096];
+    int ct = size / SMALL_FILE_SIZE;
+    struct stat st;
+    mkdir(dir, S_IRWXU);
+    for (int i = 0; i < ct; i++) {
+        FILE *fp;
+        snprintf(path, sizeof(path), "%s/f%06d.txt", dir, i);
+        if (stat(path, &st) == 0) continue;
+        if ((fp = fopen(path, "w")) == NULL) {
+            perror(path);
+            return -1;
+        }
+        generate(fp, "paragraphs.txt", SMALL_FILE_SIZE);
+        fclose(fp);
+    }
+    return ct;
+}
+
+// read the syscr and syscw counters of a process that has exited but not
+// been reaped
+void read_io(pid_t pid, long long *syscr, long long *syscw)
+{
+    char path[64], line[128];
+    FILE *fp;
+    *syscr = *syscw = -1;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    if ((fp = fopen(path, "r")) == NULL) return;
+    while (fgets(line, sizeof(line), fp)) {
+        sscanf(line, "syscr: %lld", syscr);
+        sscanf(line, "syscw: %lld", syscw);
+    }
+    fclose(fp);
+}
+
+/* run: run argv with stdout and stderr sent to /dev/null and print one
+ * result line for input_bytes of input. Returns -1 if ww could not be run
+ */
+int run(const char *label, char **argv, long long input_bytes)
+{
+    struct timespec t0, t1;
+    struct rusage ru;
+    siginfo_t info;
+    long long syscr, syscw;
+    double secs, mb = (double)input_bytes / MB;
+    int status;
+    pid_t pid;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    // wait for the exit but leave the zombie so its /proc entry can be read
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    read_io(pid, &syscr, &syscw);
+    wait4(pid, &status, 0, &ru);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "could not run %s\n", argv[0]);
+        return -1;
+    }
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%-40s %9.1f %10.1f %10.1f %8ld\n", label, mb / secs,
+        syscr / mb, syscw / mb, ru.ru_maxrss / 1024);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ww;
+    const char *dir = "bench_corpus";
+    long size = 64L * MB;
+    char path[4096], label[128], width[16], jobs[16];
+    char *args[8];
+    int small_ct;
+    int fail_check = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: ./bench_ww ww_binary [corpus_MB] [corpus_dir]\n");
+        return EXIT_FAILURE;
+    }
+    ww = argv[1];
+    if (argc > 2) size = atol(argv[2]) * MB;
+    if (argc > 3) dir = argv[3];
+    if (size < 1) {
+        fprintf(stderr, "corpus_MB must be a positive integer\n");
+        return EXIT_FAILURE;
+    }
+
+    // generate the corpora
+    mkdir(dir, S_IRWXU);
+    for (int c = 0; c < CT(corpora); c++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, corpora[c]);
+        if (make_corpus(path, corpora[c], size)) return EXIT_FAILURE;
+    }
+    snprintf(path, sizeof(path), "%s/small_files", dir);
+    if ((small_ct = make_small_files(path, size)) < 0) return EXIT_FAILURE;
+
+    printf("%-40s %9s %10s %10s %8s\n", "run", "MB/s", "reads/MB", "writes/MB",
+        "RSS(MB)");
+    // single files, every width and input strategy
+    for (int c = 0; c < CT(corpora); c++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, corpora[c]);
+        for (int w = 0; w < CT(widths); w++) {
+            for (int m = 0; m < CT(modes); m++) {
+                int a = 0;
+                snprintf(width, sizeof(width), "%d", widths[w]);
+                args[a++] = (char *)ww;
+                for (int o = 0; modes[m][o]; o++) args[a++] = (char *)modes[m][o];
+                args[a++] = width;
+                args[a++] = path;
+                args[a] = NULL;
+                snprintf(label, sizeof(label), "%s w=%d %s%s%s", corpora[c], widths[w],
+                    modes[m][0], modes[m][1] ? " " : "", modes[m][1] ? modes[m][1] : "");
+                if (run(label, args, size)) fail_check = EXIT_FAILURE;
+            }
+        }
+    }
+    // the directory loop: serial, with one worker per CPU, and on io_uring
+    snprintf(path, sizeof(path), "%s/small_files", dir);
+    snprintf(jobs, sizeof(jobs), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    for (int j = 0; j < 3; j++) {
+        int a = 0;
+        args[a++] = (char *)ww;
+        if (j == 1) {
+            args[a++] = "-j";
+            args[a++] = jobs;
+        }
+        if (j == 2) args[a++] = "--uring";
+        args[a++] = "72";
+        args[a++] = path;
+        args[a] = NULL;
+        snprintf(label, sizeof(label), "small_files (%d) w=72%s%s", small_ct,
+            j == 1 ? " -j " : j == 2 ? " --uring" : "", j == 1 ? jobs : "");
+        if (run(label, args, (long long)small_ct * SMALL_FILE_SIZE)) fail_check = EXIT_FAILURE;
+    }
+    return fail_check;
+}
@@ -0,0 +1,2032 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+#include "libww.h"
+
+#define WORDSIZE_INIT 16
+#define PARA_WORDS_INIT 64
+#define SPLIT_SIZE (4 << 20)
+#define SPLIT_WINDOW 4
+
+/* Inform user of write() errors and writing fewer than bytes than requested
+ * Return -1 if either of these situations is inferred from the arguments,
+ * 0 otherwise
+ */
+static int inform_write_err(int requested, int written)
+{    
+    int ret_value = 0;
+    if (written == -1) {
+        perror("ERROR: file write error");
+        ret_value = -1;
+    }
+    else if (written < requested) {
+        fprintf(stderr, "ERROR: tried to write %d bytes, only wrote %d\n",
+            requested, written);
+        ret_value = -1;
+    }
+    return ret_value;
+}
+
+// hand n bytes to the sink of ob, or to write() on ob->fd if it has none
+static int outbuf_emit(struct ww_outbuf *ob, const char *src, int n)
+{
+    int written = ob->sink ? ob->sink(ob->arg, src, n) : write(ob->fd, src, n);
+    ob->stats.writes++;
+    if (written > 0) ob->stats.bytes_out += written;
+    return inform_write_err(n, written);
+}
+
+/* Compression
+ * A document whose first bytes are the magic number of gzip or zstd is
+ * decompressed by ww_feed_input as it is fed, and the output of a lane set
+ * with ww_set_lane_compress is compressed as it is flushed. Both work as a
+ * stream through a CODEC_BUFSIZE buffer of their own, so memory use does not
+ * grow with the size of the document, however well it compresses. Several
+ * gzip members or zstd frames in a row make one document, as with gzip -d and
+ * zstd -d. zlib is always linked; zstd only in a build with HAVE_ZSTD (make
+ * ZSTD=1), since it is not installed everywhere. The stream states are kept
+ * between documents and reset, so each format is set up once per context.
+ */
+#define CODEC_BUFSIZE 65536
+// longest magic number
+#define MAGIC_MAX 4
+// zlib counts in uInt, so larger inputs are given to it in pieces
+#define ZLIB_CHUNK (1u << 30)
+
+static const struct {
+    int format;
+    const char *name;
+    unsigned char magic[MAGIC_MAX];
+    int len;
+} formats[] = {
+    {WW_GZIP, "gzip", {0x1f, 0x8b}, 2},
+    {WW_ZSTD, "zstd", {0x28, 0xb5, 0x2f, 0xfd}, 4},
+};
+#define FORMAT_CT ((int)(sizeof(formats) / sizeof(formats[0])))
+
+struct ww_decoder {
+    // format of the document in progress, known once started is set; until
+    // then its first bytes are collected in head
+    int format;
+    int started;
+    unsigned char head[MAGIC_MAX];
+    int head_ct;
+    // the last gzip member or zstd frame is complete
+    int stream_end;
+    // set after a corrupt stream; the rest of the document is ignored
+    int failed;
+    // gzip: the member in progress follows another one, and bytes after the
+    // last member that are not one are ignored once trailing is set
+    int next_member;
+    int trailing;
+    z_stream gz;
+    int gz_ready;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zd;
+#endif
+    char *out;
+};
+
+struct ww_encoder {
+    int format;
+    z_stream gz;
+#ifdef HAVE_ZSTD
+    ZSTD_CStream *zc;
+#endif
+    char *out;
+};
+
+int ww_format(const char *buf, size_t n)
+{
+    for (int k = 0; k < FORMAT_CT; k++) {
+        if (n >= (size_t)formats[k].len && !memcmp(buf, formats[k].magic, formats[k].len)) {
+            return formats[k].format;
+        }
+    }
+    return WW_PLAIN;
+}
+
+static const char *format_name(int format)
+{
+    for (int k = 0; k < FORMAT_CT; k++) {
+        if (formats[k].format == format) return formats[k].name;
+    }
+    return "plain";
+}
+
+static void decode_report(struct ww_ctx *ctx, const char *level, const char *msg)
+{
+    struct ww_decoder *d = ctx->decoder;
+    if (ctx->name) {
+        fprintf(stderr, "%s: %s: %s input: %s\n", level, ctx->name, format_name(d->format), msg);
+    }
+    else {
+        fprintf(stderr, "%s: %s input: %s\n", level, format_name(d->format), msg);
+    }
+}
+
+// report a corrupt or unsupported compressed input and abandon the document
+static int decode_error(struct ww_ctx *ctx, const char *msg)
+{
+    struct ww_decoder *d = ctx->decoder;
+    decode_report(ctx, "ERROR", msg);
+    d->failed = 1;
+    ctx->return_value = -2;
+    return -2;
+}
+
+// set up d for the format its head shows
+static int decoder_start(struct ww_ctx *ctx, struct ww_decoder *d)
+{
+    d->format = ww_format((const char *)d->head, d->head_ct);
+    d->started = 1;
+    d->stream_end = 0;
+    d->next_member = 0;
+    d->trailing = 0;
+    if (d->format == WW_GZIP) {
+        if (d->gz_ready) {
+            inflateReset(&d->gz);
+        }
+        else {
+            memset(&d->gz, 0, sizeof(z_stream));
+            // 16: gzip wrapper only
+            if (inflateInit2(&d->gz, 15 + 16) != Z_OK) return decode_error(ctx, "out of memory");
+            d->gz_ready = 1;
+        }
+    }
+    else if (d->format == WW_ZSTD) {
+#ifdef HAVE_ZSTD
+        if (d->zd == NULL && (d->zd = ZSTD_createDStream()) == NULL) {
+            return decode_error(ctx, "out of memory");
+        }
+        ZSTD_initDStream(d->zd);
+#else
+        return decode_error(ctx, "not supported by this build (see HAVE_ZSTD)");
+#endif
+    }
+    return 0;
+}
+
+static void gzip_trailing(struct ww_ctx *ctx, struct ww_decoder *d)
+{
+    decode_report(ctx, "WARNING", "trailing garbage ignored");
+    d->trailing = 1;
+    d->stream_end = 1;
+}
+
+static int gzip_feed(struct ww_ctx *ctx, struct ww_decoder *d, const char *buf, size_t n)
+{
+    int z;
+    size_t out_ct;
+    while (n > 0 && !d->trailing) {
+        d->gz.next_in = (Bytef *)buf;
+        d->gz.avail_in = n < ZLIB_CHUNK ? n : ZLIB_CHUNK;
+        buf += d->gz.avail_in;
+        n -= d->gz.avail_in;
+        do {
+            // another member follows the one that ended
+            if (d->stream_end && d->gz.avail_in > 0) {
+                inflateReset(&d->gz);
+                d->stream_end = 0;
+                d->next_member = 1;
+            }
+            d->gz.next_out = (Bytef *)d->out;
+            d->gz.avail_out = CODEC_BUFSIZE;
+            z = inflate(&d->gz, Z_NO_FLUSH);
+            // what follows the last member does not start with the magic
+            // number: ignore it with a warning, as gzip -d does
+            if (z == Z_DATA_ERROR && d->next_member && d->gz.total_in <= 2) {
+                gzip_trailing(ctx, d);
+                return 0;
+            }
+            if (z != Z_OK && z != Z_STREAM_END && z != Z_BUF_ERROR) {
+                return decode_error(ctx, d->gz.msg ? d->gz.msg : "corrupt data");
+            }
+            out_ct = CODEC_BUFSIZE - d->gz.avail_out;
+            if (out_ct > 0 && ww_feed(ctx, d->out, out_ct) == -2) return -2;
+            if (z == Z_STREAM_END) d->stream_end = 1;
+        } while (d->gz.avail_in > 0 || d->gz.avail_out == 0);
+    }
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_feed(struct ww_ctx *ctx, struct ww_decoder *d, const char *buf, size_t n)
+{
+    ZSTD_inBuffer in = {buf, n, 0};
+    ZSTD_outBuffer out;
+    size_t left;
+    do {
+        out.dst = d->out;
+        out.size = CODEC_BUFSIZE;
+        out.pos = 0;
+        left = ZSTD_decompressStream(d->zd, &out, &in);
+        if (ZSTD_isError(left)) return decode_error(ctx, ZSTD_getErrorName(left));
+        if (out.pos > 0 && ww_feed(ctx, d->out, out.pos) == -2) return -2;
+        // 0 once a frame is complete and flushed
+        d->stream_end = left == 0;
+    } while (in.pos < in.size || out.pos == out.size);
+    return 0;
+}
+#endif
+
+// feed n bytes of the document in d's format
+static int decoder_feed(struct ww_ctx *ctx, struct ww_decoder *d, const char *buf, size_t n)
+{
+    if (d->format == WW_GZIP) return gzip_feed(ctx, d, buf, n);
+#ifdef HAVE_ZSTD
+    if (d->format == WW_ZSTD) return zstd_feed(ctx, d, buf, n);
+#endif
+    return ww_feed(ctx, buf, n);
+}
+
+/* ww_feed_input: like ww_feed, but if the document starts with a magic
+ * number in formats, decompress it as it is fed. The first MAGIC_MAX bytes
+ * are held back until the format is known. Bytes after the last gzip member
+ * that do not start another one are ignored with a warning, as gzip -d does. Returns 0, or -2 if the document
+ * has been abandoned (a corrupt stream sets ctx->return_value to -2 as a read
+ * error does)
+ */
+int ww_feed_input(struct ww_ctx *ctx, const char *buf, size_t n)
+{
+    struct ww_decoder *d = ctx->decoder;
+    size_t take;
+    if (!ctx->decompress) return ww_feed(ctx, buf, n);
+    if (d == NULL) {
+        d = ctx->decoder = calloc(1, sizeof(struct ww_decoder));
+        d->out = malloc(sizeof(char) * CODEC_BUFSIZE);
+    }
+    if (d->failed) return -2;
+    if (!d->started) {
+        take = (size_t)(MAGIC_MAX - d->head_ct) < n ? (size_t)(MAGIC_MAX - d->head_ct) : n;
+        memcpy(d->head + d->head_ct, buf, take);
+        d->head_ct += take;
+        buf += take;
+        n -= take;
+        if (d->head_ct < MAGIC_MAX) return 0;
+        if (decoder_start(ctx, d) == -2 ||
+            decoder_feed(ctx, d, (const char *)d->head, d->head_ct) == -2) {
+            return -2;
+        }
+    }
+    return n > 0 ? decoder_feed(ctx, d, buf, n) : 0;
+}
+
+// the document ends: feed a head too short to have been looked at, and make
+// sure a compressed stream was complete
+static void decoder_end(struct ww_ctx *ctx)
+{
+    struct ww_decoder *d = ctx->decoder;
+    if (d == NULL || d->failed || ctx->return_value == -2) return;
+    if (!d->started && d->head_ct > 0 &&
+        (decoder_start(ctx, d) == -2 ||
+        decoder_feed(ctx, d, (const char *)d->head, d->head_ct) == -2)) {
+        return;
+    }
+    // a single byte after the last member is too short to start another one
+    if (d->format == WW_GZIP && d->next_member && !d->stream_end && d->gz.total_in < 2) {
+        gzip_trailing(ctx, d);
+    }
+    if (d->started && d->format != WW_PLAIN && !d->stream_end) {
+        decode_error(ctx, "unexpected end of file");
+    }
+}
+
+static void decoder_reset(struct ww_decoder *d)
+{
+    d->format = WW_PLAIN;
+    d->started = 0;
+    d->head_ct = 0;
+    d->failed = 0;
+}
+
+static void decoder_destroy(struct ww_decoder *d)
+{
+    if (d->gz_ready) inflateEnd(&d->gz);
+#ifdef HAVE_ZSTD
+    ZSTD_freeDStream(d->zd);
+#endif
+    free(d->out);
+    free(d);
+}
+
+/* encoder_run: compress n bytes from src to the sink or fd of ob, ending the
+ * stream if finish is set. Returns -1 on a write error or short write, 0
+ * otherwise
+ */
+static int encoder_run(struct ww_outbuf *ob, const char *src, int n, int finish)
+{
+    struct ww_encoder *e = ob->enc;
+    int out_ct;
+    if (e->format == WW_GZIP) {
+        e->gz.next_in = (Bytef *)src;
+        e->gz.avail_in = n;
+        do {
+            e->gz.next_out = (Bytef *)e->out;
+            e->gz.avail_out = CODEC_BUFSIZE;
+            deflate(&e->gz, finish ? Z_FINISH : Z_NO_FLUSH);
+            out_ct = CODEC_BUFSIZE - e->gz.avail_out;
+            if (out_ct > 0 && outbuf_emit(ob, e->out, out_ct)) return -1;
+        } while (e->gz.avail_out == 0);
+        if (finish) deflateReset(&e->gz);
+    }
+#ifdef HAVE_ZSTD
+    else if (e->format == WW_ZSTD) {
+        ZSTD_inBuffer in = {src, n, 0};
+        ZSTD_outBuffer out;
+        size_t left;
+        do {
+            out.dst = e->out;
+            out.size = CODEC_BUFSIZE;
+            out.pos = 0;
+            left = ZSTD_compressStream2(e->zc, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(left)) {
+                fprintf(stderr, "ERROR: zstd output: %s\n", ZSTD_getErrorName(left));
+                return -1;
+            }
+            if (out.pos > 0 && outbuf_emit(ob, e->out, out.pos)) return -1;
+        } while (finish ? left != 0 : in.pos < in.size);
+    }
+#endif
+    return 0;
+}
+
+// start a new stream, dropping whatever an abandoned document left in it
+static void encoder_reset(struct ww_encoder *e)
+{
+    if (e->format == WW_GZIP) deflateReset(&e->gz);
+#ifdef HAVE_ZSTD
+    if (e->format == WW_ZSTD) ZSTD_CCtx_reset(e->zc, ZSTD_reset_session_only);
+#endif
+}
+
+static void encoder_destroy(struct ww_encoder *e)
+{
+    if (e->format == WW_GZIP) deflateEnd(&e->gz);
+#ifdef HAVE_ZSTD
+    if (e->format == WW_ZSTD) ZSTD_freeCStream(e->zc);
+#endif
+    free(e->out);
+    free(e);
+}
+
+int ww_set_lane_compress(struct ww_ctx *ctx, int lane, int format)
+{
+    struct ww_outbuf *ob = &ctx->lanes[lane].ob;
+    struct ww_encoder *e;
+    if (format != WW_PLAIN && format != WW_GZIP) {
+#ifdef HAVE_ZSTD
+        if (format != WW_ZSTD) return -1;
+#else
+        return -1;
+#endif
+    }
+    if (ob->enc) {
+        encoder_destroy(ob->enc);
+        ob->enc = NULL;
+    }
+    if (format == WW_PLAIN) return 0;
+    e = calloc(1, sizeof(struct ww_encoder));
+    e->format = format;
+    if (format == WW_GZIP) {
+        // 16: gzip wrapper
+        if (deflateInit2(&e->gz, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(e);
+            return -1;
+        }
+    }
+#ifdef HAVE_ZSTD
+    else if ((e->zc = ZSTD_createCStream()) == NULL) {
+        free(e);
+        return -1;
+    }
+#endif
+    e->out = malloc(sizeof(char) * CODEC_BUFSIZE);
+    ob->enc = e;
+    return 0;
+}
+
+// hand n bytes on, through the encoder of ob if it has one
+static int outbuf_send(struct ww_outbuf *ob, const char *src, int n)
+{
+    if (ob->enc) return encoder_run(ob, src, n, 0);
+    return outbuf_emit(ob, src, n);
+}
+
+/* outbuf_flush: send all buffered bytes on. The buffer is emptied whether or
+ * not the write succeeded, so a failed file leaves nothing behind for the
+ * next one. Returns -1 on a write error or short write, 0 otherwise
+ */
+static int outbuf_flush(struct ww_outbuf *ob)
+{
+    int requested = ob->ct;
+    if (requested == 0 || ob->in_memory) return 0;
+    ob->ct = 0;
+    return outbuf_send(ob, ob->data, requested);
+}
+
+/* outbuf_end: flush ob and end its compressed stream, if it has an encoder.
+ * Returns -1 on a write error or short write, 0 otherwise
+ */
+static int outbuf_end(struct ww_outbuf *ob)
+{
+    if (outbuf_flush(ob)) return -1;
+    if (ob->enc && !ob->in_memory) return encoder_run(ob, NULL, 0, 1);
+    return 0;
+}
+
+/* outbuf_write: append n bytes from src to ob, flushing first if they do not
+ * fit. Blocks at least as large as the buffer are sent straight through.
+ * Returns -1 on a write error or short write, 0 otherwise
+ */
+static int outbuf_write(struct ww_outbuf *ob, const char *src, int n)
+{
+    if (ob->in_memory) {
+        while (ob->ct + n > ob->size) {
+            ob->size *= 2;
+            ob->data = realloc(ob->data, ob->size * sizeof(char));
+        }
+    }
+    else if (ob->ct + n > ob->size) {
+        if (outbuf_flush(ob)) return -1;
+        if (n >= ob->size) {
+            return outbuf_send(ob, src, n);
+        }
+    }
+    memcpy(ob->data + ob->ct, src, n);
+    ob->ct += n;
+    return 0;
+}
+
+static void stats_add(struct ww_stats *to, const struct ww_stats *from)
+{
+    to->bytes_in += from->bytes_in;
+    to->reads += from->reads;
+    to->words += from->words;
+    to->bytes_out += from->bytes_out;
+    to->writes += from->writes;
+    to->lines += from->lines;
+    to->paragraphs += from->paragraphs;
+    to->alerts += from->alerts;
+}
+
+static void add_chars(struct ww_word *word, const char *src, int n)
+{
+    // resize word if necessary
+    while (word->ct + n > word->size) {
+        word->size *= 2;
+        word->chars = realloc(word->chars, word->size * sizeof(char));
+    }
+    memcpy(word->chars + word->ct, src, n);
+    word->ct += n;
+}
+
+/*  write_word: write the word_char_ct chars starting at w to the output buffer ob.
+ *  Prepend newlines or space to the word based on whether
+ *  a) the word is long enough to need a new line given the chars already written
+ *     to the current line
+ *  b) two or more newline chars were encountered prior to the word
+ *  return values:
+ *  2: new paragraph started with no errors
+ *  1: newline started with no errors
+ *  0: newline not started, no errors
+ * -1: newline started with word length > column width (the caller reports it)
+ * -2: error occurred upon call to write() or fewer bytes were written than requested 
+ * The word is word_char_ct bytes long and takes width columns; *line_char_ct
+ * counts columns too, which are bytes unless ctx->utf8 is set
+ */
+static int write_word(struct ww_outbuf *ob, const char *w, int word_char_ct, int width,
+    int col_width, int *line_char_ct, int newline_chars)
+{
+    char nl[2] = {'\n', '\n'};
+    char sp = ' ';
+    int newlines = 0;
+    // if word has at least one char, write it to the output file
+    if (word_char_ct > 0) {
+        // determine how many newlines to prepend to the word
+        // 2 or more newlines implies a new paragraph
+        if (newline_chars > 1) {
+            newlines = 2;
+        }
+        // test against col_width to determine if the word is long enough to need
+        // a new line given the chars already written to the current line;
+        // add 1 char to account for prepended space
+        else if (*line_char_ct + 1 + width > col_width) {
+            newlines = 1;
+        }
+        // write newlines and reset *line_char_ct if indicated
+        if (newlines > 0) {
+            if (outbuf_write(ob, nl, newlines)) {
+                return -2;
+            }
+            *line_char_ct = 0;
+            ob->stats.lines++;
+            if (newlines == 2) ob->stats.paragraphs++;
+        } 
+        // write space and increment *line_char_ct if indicated
+        if (*line_char_ct > 0) {
+            if (outbuf_write(ob, &sp, 1)) {
+                return -2;
+            }
+            (*line_char_ct)++;
+        }
+        // write word to output file, increment *line_char_ct
+        if (outbuf_write(ob, w, word_char_ct)) {
+            return -2;
+        }
+        *line_char_ct += width;
+        // return newlines unless word is longer than col_width
+        if (width > col_width) {
+            return -1;
+        }
+        return newlines;
+    }
+    // if word has no chars, just return 0
+    return 0;
+}
+
+/* Long word reporting
+ * lane_alert takes every word longer than col_width. Unless max_alerts asks for
+ * the old ALERT per word, it only counts the word and keeps the first
+ * max_alerts of them with their input lines in lane->alerts; alerts_report
+ * prints them and the total in one write when the document ends. So an input
+ * full of URLs or encoded blobs costs one message per document instead of one
+ * per word.
+ */
+static void alert_add(struct ww_lane *lane, const struct ww_alert *a, int max_alerts)
+{
+    if (lane->alert_ct++ == 0 || a->len > lane->longest.len) {
+        lane->longest = *a;
+    }
+    if (lane->alerts_kept < max_alerts) {
+        if (lane->alerts == NULL) {
+            lane->alerts = malloc(sizeof(struct ww_alert) * max_alerts);
+        }
+        lane->alerts[lane->alerts_kept++] = *a;
+    }
+}
+
+// account for the word w of len bytes and width columns, wider than the
+// lane's col_width and found on input line ctx->line + 1
+static void lane_alert(struct ww_ctx *ctx, struct ww_lane *lane, const char *w, int len,
+    int width)
+{
+    struct ww_alert a;
+    int shown = len < WW_ALERT_SHOW ? len : WW_ALERT_SHOW;
+    lane->ob.stats.alerts++;
+    if (ctx->quiet_alerts) return;
+    if (ctx->max_alerts < 0) {
+        fprintf(stderr, "\nALERT: Input contains '%.*s' with width %d, "
+            "but column width is only %d\n", len, w, width, lane->col_width);
+        return;
+    }
+    // do not cut a UTF-8 char in two
+    if (ctx->utf8) {
+        while (shown > 0 && shown < len && ((unsigned char)w[shown] & 0xC0) == 0x80) shown--;
+    }
+    a.len = width;
+    a.cut = shown < len;
+    a.line = ctx->line + 1;
+    memcpy(a.word, w, shown);
+    a.word[shown] = '\0';
+    alert_add(lane, &a, ctx->max_alerts);
+}
+
+// print the long words collected for each lane and forget them
+static void alerts_report(struct ww_ctx *ctx)
+{
+    char *buf = NULL;
+    size_t ct = 0;
+    FILE *fp = NULL;
+    const char *name = ctx->name ? ctx->name : "";
+    const char *sep = ctx->name ? ": " : "";
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        struct ww_lane *lane = &ctx->lanes[k];
+        if (lane->alert_ct == 0) continue;
+        if (fp == NULL) {
+            fp = open_memstream(&buf, &ct);
+            fputc('\n', fp);
+        }
+        for (int i = 0; i < lane->alerts_kept; i++) {
+            struct ww_alert *a = &lane->alerts[i];
+            fprintf(fp, "ALERT: %s%sline %lld: Input contains '%s%s' with width %d, "
+                "but column width is only %d\n", name, sep, a->line, a->word,
+                a->cut ? "..." : "", a->len, lane->col_width);
+        }
+        if (lane->alert_ct > 1 || lane->alerts_kept == 0) {
+            fprintf(fp, "ALERT: %s%s%lld words wider than column width %d, the widest %d "
+                "%s on line %lld", name, sep, lane->alert_ct, lane->col_width,
+                lane->longest.len, ctx->utf8 ? "columns" : "chars", lane->longest.line);
+            if (lane->alert_ct > lane->alerts_kept) {
+                fprintf(fp, " (%lld not shown)", lane->alert_ct - lane->alerts_kept);
+            }
+            fputc('\n', fp);
+        }
+        lane->alert_ct = 0;
+        lane->alerts_kept = 0;
+    }
+    if (fp) {
+        fclose(fp);
+        fwrite(buf, 1, ct, stderr);
+        free(buf);
+    }
+}
+
+/* Whitespace classification
+ * ww never calls setlocale(), so isspace() has always meant the "C" locale set:
+ * ' ', '\t', '\n', '\v', '\f' and '\r'. is_ws spells that set out explicitly;
+ * bytes >= 0x80 are never whitespace, whatever the sign of char.
+ * The parser only needs two questions answered, so the scanner provides them
+ * over whole runs of bytes instead of one char at a time:
+ * skip_word:  length of the run of non-whitespace chars at the start of p
+ * skip_space: length of the run of whitespace chars at the start of p; the
+ *             number of '\n' chars in the run is added to *newlines
+ * find_high:  offset of the first byte >= 0x80 in p, or n; UTF-8 mode uses it
+ *             to send pure ASCII buffers down the byte path
+ * The first ww_init picks AVX2 (32 bytes per step), SSE2 (16 bytes per step) or
+ * the scalar versions, depending on what the CPU supports; ww_set_scanner can
+ * override the choice.
+ */
+static inline int is_ws(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+static size_t skip_word_scalar(const char *p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && !is_ws(p[i])) i++;
+    return i;
+}
+
+static size_t skip_space_scalar(const char *p, size_t n, int *newlines)
+{
+    size_t i = 0;
+    while (i < n && is_ws(p[i])) {
+        if (p[i] == '\n') (*newlines)++;
+        i++;
+    }
+    return i;
+}
+
+static size_t find_high_scalar(const char *p, size_t n)
+{
+    size_t i = 0;
+    unsigned long long v;
+    // 8 bytes at a time; memcpy keeps the load legal at any alignment
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&v, p + i, 8);
+        if (v & 0x8080808080808080ULL) break;
+    }
+    while (i < n && (unsigned char)p[i] < 0x80) i++;
+    return i;
+}
+
+#ifdef SIMD_X86
+// bit k of the result is set if p[k] is whitespace
+static inline unsigned ws_mask_sse2(__m128i v)
+{
+    // '\t'..'\r' are the bytes for which (c - '\t') <= 4 as an unsigned byte
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctrl, sp));
+}
+
+static size_t skip_word_sse2(const char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = ws_mask_sse2(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + skip_word_scalar(p + i, n - i);
+}
+
+static size_t skip_space_sse2(const char *p, size_t n, int *newlines)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned word_mask = ~ws_mask_sse2(v) & 0xFFFF;
+        unsigned nl_mask = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if (word_mask) {
+            int k = __builtin_ctz(word_mask);
+            *newlines += __builtin_popcount(nl_mask & ((1u << k) - 1));
+            return i + k;
+        }
+        *newlines += __builtin_popcount(nl_mask);
+    }
+    return i + skip_space_scalar(p + i, n - i, newlines);
+}
+
+static size_t find_high_sse2(const char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + find_high_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned ws_mask_avx2(__m256i v)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctrl, sp));
+}
+
+__attribute__((target("avx2")))
+static size_t skip_word_avx2(const char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = ws_mask_avx2(_mm256_loadu_si256((const __m256i *)(p + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + skip_word_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *p, size_t n, int *newlines)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned word_mask = ~ws_mask_avx2(v);
+        unsigned nl_mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if (word_mask) {
+            int k = __builtin_ctz(word_mask);
+            *newlines += __builtin_popcount(nl_mask & ((1u << k) - 1));
+            return i + k;
+        }
+        *newlines += __builtin_popcount(nl_mask);
+    }
+    return i + skip_space_sse2(p + i, n - i, newlines);
+}
+
+__attribute__((target("avx2")))
+static size_t find_high_avx2(const char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i *)(p + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + find_high_sse2(p + i, n - i);
+}
+#endif
+
+static size_t (*skip_word)(const char *p, size_t n) = skip_word_scalar;
+static size_t (*skip_space)(const char *p, size_t n, int *newlines) = skip_space_scalar;
+static size_t (*find_high)(const char *p, size_t n) = find_high_scalar;
+
+static int scanner_init(const char *name)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (name == NULL) {
+        name = __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+    }
+    if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+        skip_word = skip_word_avx2;
+        skip_space = skip_space_avx2;
+        find_high = find_high_avx2;
+        return 0;
+    }
+    if (!strcmp(name, "sse2")) {
+        skip_word = skip_word_sse2;
+        skip_space = skip_space_sse2;
+        find_high = find_high_sse2;
+        return 0;
+    }
+#endif
+    if (name == NULL || !strcmp(name, "scalar")) {
+        skip_word = skip_word_scalar;
+        skip_space = skip_space_scalar;
+        find_high = find_high_scalar;
+        return 0;
+    }
+    return -1;
+}
+
+
+static pthread_once_t scanner_once = PTHREAD_ONCE_INIT;
+
+static void scanner_default(void)
+{
+    scanner_init(NULL);
+}
+
+int ww_set_scanner(const char *name)
+{
+    pthread_once(&scanner_once, scanner_default);
+    return scanner_init(name);
+}
+
+/* UTF-8 mode (ctx->utf8)
+ * Columns are counted per code point as a terminal shows them: East Asian
+ * wide and fullwidth chars and most emoji take 2, combining marks and
+ * zero-width format chars take 0, everything else 1. A byte that does not
+ * start a valid sequence takes 1, as it would in byte mode. Whitespace is the
+ * ASCII set plus the Unicode White_Space chars above 0x7F, except the
+ * no-break spaces U+00A0, U+2007 and U+202F, which exist to keep words
+ * together. U+0085 and U+2028 count as a newline and U+2029 as a paragraph
+ * break. Every buffer is checked with find_high first; one with no byte
+ * >= 0x80 is parsed by the byte scanner and its words are as many columns as
+ * bytes, so ASCII text costs one vector pass more than in byte mode.
+ */
+struct cp_range {
+    int first;
+    int last;
+};
+
+// from Unicode 14: zero_width holds the general categories Mn, Me and Cf
+// (but the soft hyphen and the prepended concatenation marks, which are
+// visible), the Hangul medial and final jamo, the emoji skin tone modifiers,
+// which join the emoji before them, and the tag block; wide holds
+// East_Asian_Width W and F, whole CJK blocks and planes 2-3 included
+static const struct cp_range zero_width[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x061C, 0x061C}, {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC},
+    {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711},
+    {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x07FD, 0x07FD},
+    {0x0816, 0x0819}, {0x081B, 0x0823}, {0x0825, 0x0827}, {0x0829, 0x082D},
+    {0x0859, 0x085B}, {0x0898, 0x089F}, {0x08CA, 0x08E1}, {0x08E3, 0x0902},
+    {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D},
+    {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC},
+    {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x09E2, 0x09E3}, {0x09FE, 0x09FE},
+    {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C}, {0x0A41, 0x0A42}, {0x0A47, 0x0A48},
+    {0x0A4B, 0x0A4D}, {0x0A51, 0x0A51}, {0x0A70, 0x0A71}, {0x0A75, 0x0A75},
+    {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC5}, {0x0AC7, 0x0AC8},
+    {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3}, {0x0AFA, 0x0AFF}, {0x0B01, 0x0B01},
+    {0x0B3C, 0x0B3C}, {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D},
+    {0x0B55, 0x0B56}, {0x0B62, 0x0B63}, {0x0B82, 0x0B82}, {0x0BC0, 0x0BC0},
+    {0x0BCD, 0x0BCD}, {0x0C00, 0x0C00}, {0x0C04, 0x0C04}, {0x0C3C, 0x0C3C},
+    {0x0C3E, 0x0C40}, {0x0C46, 0x0C48}, {0x0C4A, 0x0C4D}, {0x0C55, 0x0C56},
+    {0x0C62, 0x0C63}, {0x0C81, 0x0C81}, {0x0CBC, 0x0CBC}, {0x0CBF, 0x0CBF},
+    {0x0CC6, 0x0CC6}, {0x0CCC, 0x0CCD}, {0x0CE2, 0x0CE3}, {0x0D00, 0x0D01},
+    {0x0D3B, 0x0D3C}, {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0D62, 0x0D63},
+    {0x0D81, 0x0D81}, {0x0DCA, 0x0DCA}, {0x0DD2, 0x0DD4}, {0x0DD6, 0x0DD6},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1},
+    {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x0F18, 0x0F19}, {0x0F35, 0x0F35},
+    {0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E}, {0x0F80, 0x0F84},
+    {0x0F86, 0x0F87}, {0x0F8D, 0x0F97}, {0x0F99, 0x0FBC}, {0x0FC6, 0x0FC6},
+    {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x103D, 0x103E},
+    {0x1058, 0x1059}, {0x105E, 0x1060}, {0x1071, 0x1074}, {0x1082, 0x1082},
+    {0x1085, 0x1086}, {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF},
+    {0x135D, 0x135F}, {0x1712, 0x1714}, {0x1732, 0x1733}, {0x1752, 0x1753},
+    {0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6},
+    {0x17C9, 0x17D3}, {0x17DD, 0x17DD}, {0x180B, 0x180F}, {0x1885, 0x1886},
+    {0x18A9, 0x18A9}, {0x1920, 0x1922}, {0x1927, 0x1928}, {0x1932, 0x1932},
+    {0x1939, 0x193B}, {0x1A17, 0x1A18}, {0x1A1B, 0x1A1B}, {0x1A56, 0x1A56},
+    {0x1A58, 0x1A5E}, {0x1A60, 0x1A60}, {0x1A62, 0x1A62}, {0x1A65, 0x1A6C},
+    {0x1A73, 0x1A7C}, {0x1A7F, 0x1A7F}, {0x1AB0, 0x1B03}, {0x1B34, 0x1B34},
+    {0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73},
+    {0x1B80, 0x1B81}, {0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9}, {0x1BAB, 0x1BAD},
+    {0x1BE6, 0x1BE6}, {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1},
+    {0x1C2C, 0x1C33}, {0x1C36, 0x1C37}, {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0},
+    {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4}, {0x1CF8, 0x1CF9},
+    {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+    {0x2066, 0x206F}, {0x20D0, 0x20FF}, {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F},
+    {0x2DE0, 0x2DFF}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672},
+    {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1}, {0xA802, 0xA802},
+    {0xA806, 0xA806}, {0xA80B, 0xA80B}, {0xA825, 0xA826}, {0xA82C, 0xA82C},
+    {0xA8C4, 0xA8C5}, {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D},
+    {0xA947, 0xA951}, {0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9},
+    {0xA9BC, 0xA9BD}, {0xA9E5, 0xA9E5}, {0xAA29, 0xAA2E}, {0xAA31, 0xAA32},
+    {0xAA35, 0xAA36}, {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C}, {0xAA7C, 0xAA7C},
+    {0xAAB0, 0xAAB0}, {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF},
+    {0xAAC1, 0xAAC1}, {0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5},
+    {0xABE8, 0xABE8}, {0xABED, 0xABED}, {0xD7B0, 0xD7C6}, {0xD7CB, 0xD7FB},
+    {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+    {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0},
+    {0x10376, 0x1037A}, {0x10A01, 0x10A03}, {0x10A05, 0x10A06},
+    {0x10A0C, 0x10A0F}, {0x10A38, 0x10A3A}, {0x10A3F, 0x10A3F},
+    {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27}, {0x10EAB, 0x10EAC},
+    {0x10F46, 0x10F50}, {0x10F82, 0x10F85}, {0x11001, 0x11001},
+    {0x11038, 0x11046}, {0x11070, 0x11070}, {0x11073, 0x11074},
+    {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA},
+    {0x110C2, 0x110C2}, {0x11100, 0x11102}, {0x11127, 0x1112B},
+    {0x1112D, 0x11134}, {0x11173, 0x11173}, {0x11180, 0x11181},
+    {0x111B6, 0x111BE}, {0x111C9, 0x111CC}, {0x111CF, 0x111CF},
+    {0x1122F, 0x11231}, {0x11234, 0x11234}, {0x11236, 0x11237},
+    {0x1123E, 0x1123E}, {0x112DF, 0x112DF}, {0x112E3, 0x112EA},
+    {0x11300, 0x11301}, {0x1133B, 0x1133C}, {0x11340, 0x11340},
+    {0x11366, 0x1136C}, {0x11370, 0x11374}, {0x11438, 0x1143F},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E},
+    {0x114B3, 0x114B8}, {0x114BA, 0x114BA}, {0x114BF, 0x114C0},
+    {0x114C2, 0x114C3}, {0x115B2, 0x115B5}, {0x115BC, 0x115BD},
+    {0x115BF, 0x115C0}, {0x115DC, 0x115DD}, {0x11633, 0x1163A},
+    {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB},
+    {0x116AD, 0x116AD}, {0x116B0, 0x116B5}, {0x116B7, 0x116B7},
+    {0x1171D, 0x1171F}, {0x11722, 0x11725}, {0x11727, 0x1172B},
+    {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C},
+    {0x1193E, 0x1193E}, {0x11943, 0x11943}, {0x119D4, 0x119D7},
+    {0x119DA, 0x119DB}, {0x119E0, 0x119E0}, {0x11A01, 0x11A0A},
+    {0x11A33, 0x11A38}, {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47},
+    {0x11A51, 0x11A56}, {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96},
+    {0x11A98, 0x11A99}, {0x11C30, 0x11C36}, {0x11C38, 0x11C3D},
+    {0x11C3F, 0x11C3F}, {0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0},
+    {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6}, {0x11D31, 0x11D36},
+    {0x11D3A, 0x11D3A}, {0x11D3C, 0x11D3D}, {0x11D3F, 0x11D45},
+    {0x11D47, 0x11D47}, {0x11D90, 0x11D91}, {0x11D95, 0x11D95},
+    {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4}, {0x13430, 0x13438},
+    {0x16AF0, 0x16AF4}, {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F},
+    {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4}, {0x1BC9D, 0x1BC9E},
+    {0x1BCA0, 0x1BCA3}, {0x1CF00, 0x1CF2D}, {0x1CF30, 0x1CF46},
+    {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B},
+    {0x1D1AA, 0x1D1AD}, {0x1D242, 0x1D244}, {0x1DA00, 0x1DA36},
+    {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75}, {0x1DA84, 0x1DA84},
+    {0x1DA9B, 0x1DA9F}, {0x1DAA1, 0x1DAAF}, {0x1E000, 0x1E006},
+    {0x1E008, 0x1E018}, {0x1E01B, 0x1E021}, {0x1E023, 0x1E024},
+    {0x1E026, 0x1E02A}, {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE},
+    {0x1E2EC, 0x1E2EF}, {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A},
+    {0x1F3FB, 0x1F3FF}, {0xE0000, 0xE0FFF},
+};
+
+static const struct cp_range wide[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x3029},
+    {0x302E, 0x303E}, {0x3041, 0x3096}, {0x309B, 0xA4CF}, {0xA960, 0xA97F},
+    {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE3}, {0x16FF0, 0x16FF1},
+    {0x17000, 0x18D08}, {0x1AFF0, 0x1AFF3}, {0x1AFF5, 0x1AFFB},
+    {0x1AFFD, 0x1AFFE}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+    {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248},
+    {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F320},
+    {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393},
+    {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0},
+    {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F3FA}, {0x1F400, 0x1F43E},
+    {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A},
+    {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+    {0x1F6D5, 0x1F6D7}, {0x1F6DD, 0x1F6DF}, {0x1F6EB, 0x1F6EC},
+    {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0},
+    {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+static int in_ranges(int cp, const struct cp_range *r, int ct)
+{
+    int lo = 0, hi = ct - 1, mid;
+    if (cp < r[0].first || cp > r[ct - 1].last) return 0;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (cp > r[mid].last) lo = mid + 1;
+        else if (cp < r[mid].first) hi = mid - 1;
+        else return 1;
+    }
+    return 0;
+}
+
+/* utf8_decode: store the code point of the char at p (n > 0 bytes) in *cp and
+ * return its length. A byte that does not start a valid, complete sequence
+ * (overlong forms and surrogates included) is a char of its own, with *cp -1
+ */
+static int utf8_decode(const unsigned char *p, size_t n, int *cp)
+{
+    int len, c;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (p[0] < 0x80) {
+        *cp = p[0];
+        return 1;
+    }
+    if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        len = 2;
+        c = p[0] & 0x1F;
+    }
+    else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        len = 3;
+        c = p[0] & 0x0F;
+        if (p[0] == 0xE0) lo = 0xA0;
+        if (p[0] == 0xED) hi = 0x9F;
+    }
+    else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        len = 4;
+        c = p[0] & 0x07;
+        if (p[0] == 0xF0) lo = 0x90;
+        if (p[0] == 0xF4) hi = 0x8F;
+    }
+    else {
+        *cp = -1;
+        return 1;
+    }
+    if ((size_t)len > n || p[1] < lo || p[1] > hi) {
+        *cp = -1;
+        return 1;
+    }
+    for (int k = 1; k < len; k++) {
+        if ((p[k] & 0xC0) != 0x80) {
+            *cp = -1;
+            return 1;
+        }
+        c = c << 6 | (p[k] & 0x3F);
+    }
+    *cp = c;
+    return len;
+}
+
+static int cp_width(int cp)
+{
+    if (cp < 0x300) return 1;
+    if (in_ranges(cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0]))) return 0;
+    if (in_ranges(cp, wide, sizeof(wide) / sizeof(wide[0]))) return 2;
+    return 1;
+}
+
+int ww_utf8_width(const char *s, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    int width = 0, cp;
+    size_t i = 0;
+    while (i < n) {
+        if (p[i] < 0x80) {
+            width++;
+            i++;
+            continue;
+        }
+        i += utf8_decode(p + i, n - i, &cp);
+        width += cp_width(cp);
+    }
+    return width;
+}
+
+/* mb_space: length of the whitespace char above 0x7F at p, or 0 if there is
+ * none; the newlines it stands for are added to *newlines
+ */
+static int mb_space(const char *s, size_t n, int *newlines)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    if (n >= 2 && p[0] == 0xC2 && p[1] == 0x85) {
+        (*newlines)++;
+        return 2;
+    }
+    if (n < 3) return 0;
+    if (p[0] == 0xE2 && p[1] == 0x80) {
+        // U+2000..U+200A, but not the figure space U+2007
+        if (p[2] <= 0x8A && p[2] != 0x87) return 3;
+        if (p[2] == 0xA8 || p[2] == 0xA9) {
+            *newlines += p[2] == 0xA8 ? 1 : 2;
+            return 3;
+        }
+        return 0;
+    }
+    if ((p[0] == 0xE1 && p[1] == 0x9A && p[2] == 0x80) ||
+        (p[0] == 0xE2 && p[1] == 0x81 && p[2] == 0x9F) ||
+        (p[0] == 0xE3 && p[1] == 0x80 && p[2] == 0x80)) {
+        return 3;
+    }
+    return 0;
+}
+
+int ww_utf8_space(const char *p, size_t n)
+{
+    int newlines = 0;
+    if (n == 0) return 0;
+    if (is_ws(p[0])) return 1;
+    return mb_space(p, n, &newlines);
+}
+
+// skip_word and skip_space for UTF-8 mode: the byte scanner finds the ASCII
+// whitespace, and only the bytes >= 0x80 in between are looked at one by one
+static size_t skip_word_utf8(const char *p, size_t n)
+{
+    size_t end = skip_word(p, n);
+    size_t i = 0;
+    int newlines = 0;
+    while ((i += find_high(p + i, end - i)) < end) {
+        if (mb_space(p + i, n - i, &newlines)) return i;
+        i++;
+    }
+    return end;
+}
+
+static size_t skip_space_utf8(const char *p, size_t n, int *newlines)
+{
+    size_t i = 0;
+    int k;
+    for (;;) {
+        i += skip_space(p + i, n - i, newlines);
+        if (i == n || (k = mb_space(p + i, n - i, newlines)) == 0) return i;
+        i += k;
+    }
+}
+
+// length of an incomplete UTF-8 sequence at the end of the n bytes at p, 0 if
+// the last char is complete (or not valid UTF-8 at all)
+static int utf8_cut(const char *p, size_t n)
+{
+    int back, len;
+    unsigned char c;
+    for (back = 1; back <= 3 && (size_t)back <= n; back++) {
+        c = (unsigned char)p[n - back];
+        if ((c & 0xC0) != 0x80) {
+            len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            return c >= 0xC2 && c <= 0xF4 && len > back ? back : 0;
+        }
+    }
+    return 0;
+}
+
+static void lane_init(struct ww_lane *lane, int col_width, int outbuf_size)
+{
+    lane->col_width = col_width;
+    lane->line_char_ct = 0;
+    lane->return_value = 1;
+    lane->result = 1;
+    lane->ob.sink = NULL;
+    lane->ob.arg = NULL;
+    lane->ob.fd = STDOUT_FILENO;
+    lane->ob.data = malloc(sizeof(char) * outbuf_size);
+    lane->ob.ct = 0;
+    lane->ob.size = outbuf_size;
+    lane->ob.in_memory = 0;
+    memset(&lane->ob.stats, 0, sizeof(struct ww_stats));
+    lane->ob.enc = NULL;
+    lane->alert_ct = 0;
+    lane->alerts = NULL;
+    lane->alerts_kept = 0;
+    lane->para.chars = malloc(sizeof(char) * WORDSIZE_INIT);
+    lane->para.ct = 0;
+    lane->para.size = WORDSIZE_INIT;
+    lane->para.words = 0;
+    lane->para.words_size = PARA_WORDS_INIT;
+    lane->para.off = malloc(sizeof(int) * PARA_WORDS_INIT);
+    lane->para.col = malloc(sizeof(int) * PARA_WORDS_INIT);
+    lane->para.cols = 0;
+    lane->para.cost = malloc(sizeof(double) * PARA_WORDS_INIT);
+    lane->para.brk = malloc(sizeof(int) * PARA_WORDS_INIT);
+    lane->para.queue = malloc(sizeof(int) * PARA_WORDS_INIT);
+    lane->para.queue_start = malloc(sizeof(int) * PARA_WORDS_INIT);
+}
+
+static void lane_destroy(struct ww_lane *lane)
+{
+    free(lane->ob.data);
+    if (lane->ob.enc) encoder_destroy(lane->ob.enc);
+    free(lane->alerts);
+    free(lane->para.chars);
+    free(lane->para.off);
+    free(lane->para.col);
+    free(lane->para.cost);
+    free(lane->para.brk);
+    free(lane->para.queue);
+    free(lane->para.queue_start);
+}
+
+void ww_init(struct ww_ctx *ctx, int col_width, int outbuf_size)
+{
+    pthread_once(&scanner_once, scanner_default);
+    ctx->word.chars = malloc(sizeof(char) * WORDSIZE_INIT);
+    ctx->word.size = WORDSIZE_INIT;
+    ctx->lanes = NULL;
+    ctx->lane_ct = 0;
+    ww_add_lane(ctx, col_width, outbuf_size);
+    ctx->bufsize = WW_BUFSIZE;
+    ctx->use_mmap = 0;
+    ctx->readbuf = NULL;
+    ctx->decompress = 1;
+    ctx->decoder = NULL;
+    ctx->optimal = 0;
+    memset(&ctx->stats, 0, sizeof(struct ww_stats));
+    ctx->max_alerts = -1;
+    ctx->quiet_alerts = 0;
+    ctx->name = NULL;
+    ctx->keep_alerts = 0;
+    ctx->utf8 = 0;
+    ctx->return_value = 1;
+    ww_reset(ctx);
+}
+
+void ww_destroy(struct ww_ctx *ctx)
+{
+    free(ctx->word.chars);
+    free(ctx->readbuf);
+    if (ctx->decoder) decoder_destroy(ctx->decoder);
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        lane_destroy(&ctx->lanes[k]);
+    }
+    free(ctx->lanes);
+}
+
+// wrap to col_width as well, starting with the next document; output goes to
+// stdout until ww_set_lane_fd says otherwise. Returns the index of the lane
+int ww_add_lane(struct ww_ctx *ctx, int col_width, int outbuf_size)
+{
+    ctx->lanes = realloc(ctx->lanes, sizeof(struct ww_lane) * (ctx->lane_ct + 1));
+    lane_init(&ctx->lanes[ctx->lane_ct], col_width, outbuf_size);
+    return ctx->lane_ct++;
+}
+
+// start a new document: forget any parser state and partial word, and report
+// the long words of the last one. Output ww_finish has flushed (or left in an
+// in_memory buffer) is kept. If the last document was abandoned, which a read
+// error does to every lane, the output it left unflushed is dropped so that it
+// cannot turn up in the next document
+void ww_reset(struct ww_ctx *ctx)
+{
+    int read_result = ctx->return_value;
+    if (!ctx->keep_alerts) alerts_report(ctx);
+    ctx->line = 0;
+    ctx->BOF = 1;
+    ctx->newline_chars = 0;
+    ctx->prev_newline_chars = 0;
+    ctx->in_word = 0;
+    ctx->terminate = 1;
+    ctx->return_value = 1;
+    ctx->word.ct = 0;
+    ctx->pend_ct = 0;
+    if (ctx->decoder) decoder_reset(ctx->decoder);
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        struct ww_lane *lane = &ctx->lanes[k];
+        if (lane->ob.enc) encoder_reset(lane->ob.enc);
+        lane->line_char_ct = 0;
+        lane->result = read_result < lane->return_value ? read_result : lane->return_value;
+        if (lane->result == -2) lane->ob.ct = 0;
+        lane->return_value = 1;
+        lane->para.ct = 0;
+        lane->para.words = 0;
+        lane->para.cols = 0;
+    }
+}
+
+// send output of the given lane to write() on fd
+void ww_set_lane_fd(struct ww_ctx *ctx, int lane, int fd)
+{
+    struct ww_outbuf *ob = &ctx->lanes[lane].ob;
+    ob->sink = NULL;
+    ob->fd = fd;
+    ob->in_memory = 0;
+}
+
+// send output to write() on fd
+void ww_set_fd(struct ww_ctx *ctx, int fd)
+{
+    ww_set_lane_fd(ctx, 0, fd);
+}
+
+// send output of the given lane to sink(arg, ...)
+void ww_set_lane_sink(struct ww_ctx *ctx, int lane, ww_sink sink, void *arg)
+{
+    struct ww_outbuf *ob = &ctx->lanes[lane].ob;
+    ob->sink = sink;
+    ob->arg = arg;
+    ob->in_memory = 0;
+}
+
+// send output to sink(arg, ...)
+void ww_set_sink(struct ww_ctx *ctx, ww_sink sink, void *arg)
+{
+    ww_set_lane_sink(ctx, 0, sink, arg);
+}
+
+// keep output in ctx->lanes[0].ob.data; the caller takes ob.ct bytes after
+// ww_finish and sets ob.ct to 0
+void ww_set_memory(struct ww_ctx *ctx)
+{
+    ctx->lanes[0].ob.sink = NULL;
+    ctx->lanes[0].ob.in_memory = 1;
+}
+
+/* Optimal mode
+ * Each paragraph is collected in the para of every lane and broken into lines when the
+ * next paragraph starts or the document ends. A word longer than col_width
+ * gets a line of its own, which splits the paragraph into segments that are
+ * broken separately; like the last line of the paragraph, the line before
+ * such a word costs nothing.
+ */
+static void para_add(struct ww_para *para, const char *w, int len, int width)
+{
+    // off needs room for the offset after the last word too
+    if (para->words + 2 > para->words_size) {
+        para->words_size *= 2;
+        para->off = realloc(para->off, para->words_size * sizeof(int));
+        para->col = realloc(para->col, para->words_size * sizeof(int));
+        para->cost = realloc(para->cost, para->words_size * sizeof(double));
+        para->brk = realloc(para->brk, para->words_size * sizeof(int));
+        para->queue = realloc(para->queue, para->words_size * sizeof(int));
+        para->queue_start = realloc(para->queue_start, para->words_size * sizeof(int));
+    }
+    while (para->ct + len + 1 > para->size) {
+        para->size *= 2;
+        para->chars = realloc(para->chars, para->size * sizeof(char));
+    }
+    para->col[para->words] = para->cols;
+    para->off[para->words++] = para->ct;
+    memcpy(para->chars + para->ct, w, len);
+    para->ct += len;
+    para->chars[para->ct++] = ' ';
+    para->cols += width + 1;
+    para->off[para->words] = para->ct;
+    para->col[para->words] = para->cols;
+}
+
+// cost of the line made of words i..j-1, given their columns
+static inline double line_cost(const int *col, int i, int j, int col_width)
+{
+    double slack = col_width - (col[j] - col[i] - 1);
+    return slack < 0 ? INFINITY : slack * slack;
+}
+
+// whether ending the line before word j at candidate i costs no more than at k
+static inline int beats(const double *f, const int *col, int i, int k, int j, int col_width)
+{
+    return f[i] + line_cost(col, i, j, col_width) <= f[k] + line_cost(col, k, j, col_width);
+}
+
+/* para_break: choose the lines for words a..b-1 of para, none of them longer
+ * than col_width. f[j] is the least cost of the lines that hold the first j
+ * words; it is f[i] plus the cost of line i..j for the best candidate i. That
+ * cost is a convex function of the line length, so a candidate that beats an
+ * earlier one for some j beats it for every later j as well. The queue keeps
+ * the candidates that can still win, each with the first j it wins at (found
+ * by binary search), which makes this O(n log n) instead of trying every i for
+ * every j. Stores the first word of each line in para->queue and returns the
+ * number of lines
+ */
+static int para_break(struct ww_para *para, int a, int b, int col_width)
+{
+    int n = b - a;
+    int *col = para->col + a;
+    double *f = para->cost;
+    int *brk = para->brk;
+    int *qc = para->queue, *qs = para->queue_start;
+    int head = 0, tail = 0;
+    int last, lines, lo, hi, mid, x;
+    f[0] = 0;
+    qc[tail] = 0;
+    qs[tail++] = 1;
+    for (int j = 1; j < n; j++) {
+        while (tail - head > 1 && qs[head + 1] <= j) head++;
+        brk[j] = qc[head];
+        f[j] = f[brk[j]] + line_cost(col, brk[j], j, col_width);
+        if (j + 1 == n) break;
+        // drop the candidates that j beats from the first j they would win at
+        while (tail > head) {
+            lo = qs[tail - 1] > j + 1 ? qs[tail - 1] : j + 1;
+            if (!beats(f, col, j, qc[tail - 1], lo, col_width)) break;
+            tail--;
+        }
+        if (tail == head) {
+            qc[tail] = j;
+            qs[tail++] = j + 1;
+            continue;
+        }
+        lo = (qs[tail - 1] > j + 1 ? qs[tail - 1] : j + 1) + 1;
+        hi = n;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (beats(f, col, j, qc[tail - 1], mid, col_width)) hi = mid;
+            else lo = mid + 1;
+        }
+        if (lo < n) {
+            qc[tail] = j;
+            qs[tail++] = lo;
+        }
+    }
+    // the last line is free, so it starts at the cheapest i it can hold
+    last = n - 1;
+    for (int i = n - 2; i >= 0 && col[n] - col[i] - 1 <= col_width; i--) {
+        if (f[i] < f[last]) last = i;
+    }
+    // follow the breaks back from the last line, then put them in order
+    lines = 0;
+    for (x = last; ; x = brk[x]) {
+        qc[lines++] = a + x;
+        if (x == 0) break;
+    }
+    for (int k = 0; k < lines / 2; k++) {
+        x = qc[k];
+        qc[k] = qc[lines - 1 - k];
+        qc[lines - 1 - k] = x;
+    }
+    return lines;
+}
+
+/* para_flush: write the paragraph collected in lane->para, one line per break,
+ * and empty it. Words longer than col_width produce the same ALERT as in
+ * greedy mode. Returns -2 on a write error, 0 otherwise
+ */
+static int para_flush(struct ww_lane *lane)
+{
+    struct ww_para *para = &lane->para;
+    int col_width = lane->col_width;
+    int *off = para->off, *col = para->col;
+    int a = 0, b, lines, start, end, len;
+    int return_value = 0;
+    while (a < para->words && return_value == 0) {
+        if (col[a + 1] - col[a] - 1 > col_width) {
+            lines = 1;
+            para->queue[0] = a;
+            b = a + 1;
+        }
+        else {
+            for (b = a + 1; b < para->words && col[b + 1] - col[b] - 1 <= col_width; b++);
+            lines = para_break(para, a, b, col_width);
+        }
+        for (int k = 0; k < lines; k++) {
+            start = para->queue[k];
+            end = k + 1 < lines ? para->queue[k + 1] : b;
+            len = off[end] - off[start] - 1;
+            if ((start > 0 && outbuf_write(&lane->ob, "\n", 1)) ||
+                outbuf_write(&lane->ob, para->chars + off[start], len)) {
+                return_value = -2;
+                break;
+            }
+            if (start > 0) lane->ob.stats.lines++;
+            // the word was reported by lane_word
+            if (col[end] - col[start] - 1 > col_width) {
+                lane->return_value = -1;
+            }
+        }
+        a = b;
+    }
+    para->ct = 0;
+    para->words = 0;
+    para->cols = 0;
+    return return_value;
+}
+
+/* lane_word: pass a completed word of len bytes and width columns to
+ * write_word for one lane along with the newline chars that preceded it.
+ * Returns -2 on a write error, 0 otherwise
+ */
+static int lane_word(struct ww_ctx *ctx, struct ww_lane *lane, const char *w, int len,
+    int width)
+{
+    int write_result;
+    if (ctx->optimal) {
+        // two or more newline chars end the paragraph collected so far
+        if (ctx->prev_newline_chars > 1) {
+            if (para_flush(lane) || outbuf_write(&lane->ob, "\n\n", 2)) {
+                return -2;
+            }
+            lane->ob.stats.lines++;
+            lane->ob.stats.paragraphs++;
+        }
+        para_add(&lane->para, w, len, width);
+        if (width > lane->col_width) lane_alert(ctx, lane, w, len, width);
+        return 0;
+    }
+    write_result = write_word(&lane->ob, w, len, width, lane->col_width,
+        &lane->line_char_ct, ctx->prev_newline_chars);
+    // stop writing this lane if write_word returns an error value of -2
+    if (write_result == -2) {
+        return -2;
+    }
+    // set return_value if write_word returns an error value of -1,
+    // but continue parsing
+    else if (write_result == -1) {
+        lane->return_value = write_result;
+        lane_alert(ctx, lane, w, len, width);
+    }
+    return 0;
+}
+
+/* emit_word: pass a completed word to every lane that is still writing. A
+ * lane whose output failed is dropped for the rest of the document.
+ * Returns -2 once no lane is left, 0 otherwise
+ */
+static int emit_word(struct ww_ctx *ctx, const char *w, int len, int width)
+{
+    int live = 0;
+    ctx->stats.words++;
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        struct ww_lane *lane = &ctx->lanes[k];
+        if (lane->return_value == -2) continue;
+        if (lane_word(ctx, lane, w, len, width) == -2) {
+            lane->return_value = -2;
+        }
+        else {
+            live++;
+        }
+    }
+    return live ? 0 : -2;
+}
+
+// columns of the word w of len bytes
+static inline int word_width(const struct ww_ctx *ctx, const char *w, int len)
+{
+    return ctx->utf8 ? ww_utf8_width(w, len) : len;
+}
+
+/* feed_run: the parser behind ww_feed, for one run of whole chars. utf8 is
+ * set if the run is to be parsed as UTF-8; otherwise every byte is a column
+ */
+static int feed_run(struct ww_ctx *ctx, const char *buf, size_t n, int utf8)
+{
+    size_t (*word)(const char *p, size_t n) = utf8 ? skip_word_utf8 : skip_word;
+    size_t (*space)(const char *p, size_t n, int *newlines) =
+        utf8 ? skip_space_utf8 : skip_space;
+    size_t i = 0, start;
+    int result;
+    int newlines;
+    // finish a word carried over from the previous buffer
+    if (ctx->in_word) {
+        i = word(buf, n);
+        add_chars(&ctx->word, buf, i);
+        if (i == n) return 0;
+        ctx->in_word = 0;
+        result = emit_word(ctx, ctx->word.chars, ctx->word.ct,
+            word_width(ctx, ctx->word.chars, ctx->word.ct));
+        ctx->word.ct = 0;
+        if (result == -2) return -2;
+    }
+    while (i < n) {
+        newlines = 0;
+        i += space(buf + i, n - i, &newlines);
+        ctx->line += newlines;
+        // ignore any whitespace at the beginning of the input file
+        if (!ctx->BOF) ctx->newline_chars += newlines;
+        if (i == n) break;
+        ctx->BOF = 0;
+        ctx->prev_newline_chars = ctx->newline_chars;
+        ctx->newline_chars = 0;
+        start = i;
+        i += word(buf + i, n - i);
+        if (i == n) {
+            add_chars(&ctx->word, buf + start, n - start);
+            ctx->in_word = 1;
+            return 0;
+        }
+        if (emit_word(ctx, buf + start, i - start,
+            utf8 ? ww_utf8_width(buf + start, i - start) : (int)(i - start)) == -2) {
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/* ww_feed: parse n chars of input from buf, writing each word to the output
+ * buffer as soon as the whitespace that ends it is found; by then all newline
+ * chars before the word have been counted, which ensures correct paragraph
+ * formatting. A word that runs into the end of buf is copied to ctx->word and
+ * finished on the next call. In UTF-8 mode a char cut by the end of buf is
+ * held back in ctx->pend until the next call completes it.
+ * Returns -2 if write errors have stopped every lane, 0 otherwise. After -2
+ * the document is abandoned: call ww_reset before feeding the next one
+ */
+int ww_feed(struct ww_ctx *ctx, const char *buf, size_t n)
+{
+    int k, cut;
+    ctx->stats.bytes_in += n;
+    if (!ctx->utf8) return feed_run(ctx, buf, n, 0);
+    // complete the char the last buffer ended in the middle of
+    if (ctx->pend_ct > 0) {
+        for (k = 0; k < (int)n && (buf[k] & 0xC0) == 0x80 &&
+            utf8_cut(ctx->pend, ctx->pend_ct) > 0; k++) {
+            ctx->pend[ctx->pend_ct++] = buf[k];
+        }
+        if (k == (int)n && utf8_cut(ctx->pend, ctx->pend_ct) > 0) return 0;
+        if (feed_run(ctx, ctx->pend, ctx->pend_ct, 1) == -2) return -2;
+        ctx->pend_ct = 0;
+        buf += k;
+        n -= k;
+    }
+    // hold back a char this buffer ends in the middle of
+    cut = utf8_cut(buf, n);
+    memcpy(ctx->pend, buf + n - cut, cut);
+    ctx->pend_ct = cut;
+    n -= cut;
+    // pure ASCII takes the byte path
+    return feed_run(ctx, buf, n, find_high(buf, n) < n);
+}
+
+// write the last word and the terminating newline of one lane and flush it
+static void lane_finish(struct ww_ctx *ctx, struct ww_lane *lane)
+{
+    int write_result = 0;
+    if (lane->return_value == -2) return;
+    // attempt one final write
+    if (ctx->optimal) {
+        // the last word ends the last paragraph
+        if (ctx->word.ct > 0) {
+            write_result = lane_word(ctx, lane, ctx->word.chars, ctx->word.ct,
+                word_width(ctx, ctx->word.chars, ctx->word.ct));
+        }
+        if (write_result == 0 && para_flush(lane)) {
+            write_result = -2;
+        }
+    }
+    else {
+        int width = word_width(ctx, ctx->word.chars, ctx->word.ct);
+        write_result = write_word(&lane->ob, ctx->word.chars, ctx->word.ct, width,
+            lane->col_width, &lane->line_char_ct, ctx->prev_newline_chars);
+        if (write_result == -1) {
+            lane_alert(ctx, lane, ctx->word.chars, ctx->word.ct, width);
+        }
+    }
+    if (write_result < 0) {
+        lane->return_value = write_result;
+    }
+    // need to terminate output with a newline unless the input file had no words
+    if (!ctx->BOF && ctx->terminate && write_result != -2) {
+        char nl = '\n';
+        write_result = outbuf_write(&lane->ob, &nl, 1) ? -2 : 0;
+        if (write_result == 0) {
+            lane->ob.stats.lines++;
+            lane->ob.stats.paragraphs++;
+        }
+    }
+    // hand whatever is still buffered on; a failed flush aborts this document only
+    if (write_result == -2 || outbuf_end(&lane->ob)) {
+        lane->return_value = -2;
+    }
+}
+
+/* ww_finish: write the last word and the terminating newline of every lane,
+ * flush the output buffers and reset ctx for the next document. Returns 1, -1
+ * or -2 as described in libww.h
+ */
+int ww_finish(struct ww_ctx *ctx)
+{
+    int return_value = 1;
+    decoder_end(ctx);
+    // a char cut off by the end of the document is a char of invalid bytes
+    if (ctx->pend_ct > 0) {
+        feed_run(ctx, ctx->pend, ctx->pend_ct, 1);
+        ctx->pend_ct = 0;
+    }
+    if (ctx->word.ct > 0) ctx->stats.words++;
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        struct ww_lane *lane = &ctx->lanes[k];
+        lane_finish(ctx, lane);
+        // a read error spoils every lane
+        if (ctx->return_value < lane->return_value) {
+            lane->return_value = ctx->return_value;
+        }
+        if (lane->return_value < return_value) {
+            return_value = lane->return_value;
+        }
+    }
+    ww_reset(ctx);
+    return return_value;
+}
+
+/* map_content: if fd_in is a non-empty regular file, map it and feed the whole
+ * mapping in place. Returns 1 and stores ww_feed's result in *result if the
+ * file was mapped, 0 if the caller should fall back to read()
+ */
+static int map_content(struct ww_ctx *ctx, int fd_in, int *result)
+{
+    struct stat st;
+    char *map;
+    if (fstat(fd_in, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_in, 0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *result = ww_feed_input(ctx, map, st.st_size);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+/* ww_process_fd: read the contents of the input file and wrap them to the
+ * output of ctx. fd_in is assumed to be open already; the output buffer is
+ * flushed before returning. Input is read through a ctx->bufsize-byte buffer,
+ * or mapped when ctx->use_mmap is set and fd_in is a regular file; pipes and
+ * terminals always use read(). Compressed input is decompressed as it is read
+ * (see ww_feed_input).
+ * Returns 1 if all file operations completed successfully. If write_word returns
+ * an error value (i.e. an int < 0), ww_process_fd returns that value. If a
+ * read error or a failed final flush occurs, ww_process_fd returns -2.
+ */
+int ww_process_fd(struct ww_ctx *ctx, int fd_in)
+{
+    ssize_t bytes_read = 0;
+    int result = 0;
+
+    if (ctx->use_mmap && map_content(ctx, fd_in, &result)) {
+        if (result == -2) {
+            ww_reset(ctx);
+            return -2;
+        }
+        return ww_finish(ctx);
+    }
+    // the read buffer is kept for the next file
+    if (ctx->readbuf == NULL) {
+        ctx->readbuf = malloc(sizeof(char) * ctx->bufsize);
+    }
+    while ((bytes_read = read(fd_in, ctx->readbuf, ctx->bufsize)) > 0) {
+        ctx->stats.reads++;
+        if (ww_feed_input(ctx, ctx->readbuf, bytes_read) == -2) {
+            ww_reset(ctx);
+            return -2;
+        }
+    }
+    // the call that found the end of the file, or failed
+    ctx->stats.reads++;
+    // inform of read errors
+    if (bytes_read < 0) {
+        perror("ERROR: file read error");
+        ctx->return_value = -2;
+    }
+    return ww_finish(ctx);
+}
+
+/* Paragraph splitting
+ * Each paragraph wraps independently of the text before it: the first word
+ * after two or more newline chars always starts with "\n\n" and resets
+ * line_char_ct. So a mapped file can be cut just before the first word of a
+ * paragraph, the pieces wrapped on several threads by contexts with in-memory
+ * output, and the results written out in order. A piece other than the first starts in the
+ * state the serial parser would be in after a paragraph break; a piece other
+ * than the last ends with the break itself and so emits no trailing newline.
+ * The main thread writes finished pieces while workers wrap later ones; at most
+ * SPLIT_WINDOW pieces per thread are held in memory at a time.
+ */
+struct split_piece {
+    const char *start;
+    size_t len;
+    // wrapped output, owned by the piece once done is set
+    char *out;
+    int out_ct;
+    int result;
+    int done;
+    // newline chars in the piece, and its long words, numbered by their
+    // lines within the piece
+    long long lines;
+    long long alert_ct;
+    struct ww_alert longest;
+    struct ww_alert *alerts;
+    int alerts_kept;
+};
+
+struct split_job {
+    struct split_piece *pieces;
+    int piece_ct;
+    // index of the next piece a worker may take
+    int next;
+    // index of the next piece to be written; workers stay within window of it
+    int written;
+    int window;
+    int col_width;
+    int optimal;
+    int utf8;
+    int max_alerts;
+    int quiet_alerts;
+    // what the workers' contexts counted, on the input and the output side
+    struct ww_stats in_stats;
+    struct ww_stats out_stats;
+    pthread_mutex_t lock;
+    pthread_cond_t piece_done;
+    pthread_cond_t piece_written;
+};
+
+/* find_paragraph: return the offset of the first word that follows a run of
+ * whitespace with two or more newline chars, searching buf from from. The run
+ * must be preceded by a word that starts at or after from, so leading
+ * whitespace is never taken for a break; returns n if there is no such run
+ */
+static size_t find_paragraph(const char *buf, size_t n, size_t from, int utf8)
+{
+    size_t (*word)(const char *p, size_t n) = utf8 ? skip_word_utf8 : skip_word;
+    size_t (*space)(const char *p, size_t n, int *newlines) =
+        utf8 ? skip_space_utf8 : skip_space;
+    size_t i = from;
+    int newlines = 0;
+    // a search that starts inside a whitespace run cannot see the whole run
+    i += space(buf + i, n - i, &newlines);
+    while (i < n) {
+        i += word(buf + i, n - i);
+        newlines = 0;
+        i += space(buf + i, n - i, &newlines);
+        if (newlines > 1 && i < n) return i;
+    }
+    return n;
+}
+
+// add the long words of piece, whose first line is line base + 1 of the file,
+// to those of lane
+static void alerts_merge(struct ww_lane *lane, const struct split_piece *piece,
+    long long base, int max_alerts)
+{
+    for (int i = 0; i < piece->alerts_kept && lane->alerts_kept < max_alerts; i++) {
+        if (lane->alerts == NULL) {
+            lane->alerts = malloc(sizeof(struct ww_alert) * max_alerts);
+        }
+        lane->alerts[lane->alerts_kept] = piece->alerts[i];
+        lane->alerts[lane->alerts_kept++].line += base;
+    }
+    if (piece->alert_ct > 0 && (lane->alert_ct == 0 || piece->longest.len > lane->longest.len)) {
+        lane->longest = piece->longest;
+        lane->longest.line += base;
+    }
+    lane->alert_ct += piece->alert_ct;
+}
+
+static void *split_worker(void *arg)
+{
+    struct split_job *job = arg;
+    struct split_piece *piece;
+    struct ww_ctx ctx;
+    int k;
+    struct ww_outbuf *ob;
+    ww_init(&ctx, job->col_width, WW_OUTBUFSIZE);
+    ww_set_memory(&ctx);
+    ob = &ctx.lanes[0].ob;
+    ctx.optimal = job->optimal;
+    ctx.utf8 = job->utf8;
+    ctx.max_alerts = job->max_alerts;
+    ctx.quiet_alerts = job->quiet_alerts;
+    // long words are reported by the caller, with lines counted from the
+    // start of the file
+    ctx.keep_alerts = job->max_alerts >= 0;
+    pthread_mutex_lock(&job->lock);
+    while (job->next < job->piece_ct) {
+        if (job->next >= job->written + job->window) {
+            pthread_cond_wait(&job->piece_written, &job->lock);
+            continue;
+        }
+        k = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        piece = &job->pieces[k];
+        if (k > 0) {
+            // pick up where the serial parser would be after a paragraph break
+            ctx.BOF = 0;
+            ctx.newline_chars = 2;
+        }
+        ctx.terminate = (k == job->piece_ct - 1);
+        ww_feed(&ctx, piece->start, piece->len);
+        piece->lines = ctx.line;
+        piece->result = ww_finish(&ctx);
+        // hand the long words to the piece as well
+        piece->alert_ct = ctx.lanes[0].alert_ct;
+        piece->longest = ctx.lanes[0].longest;
+        piece->alerts = ctx.lanes[0].alerts;
+        piece->alerts_kept = ctx.lanes[0].alerts_kept;
+        ctx.lanes[0].alert_ct = 0;
+        ctx.lanes[0].alerts = NULL;
+        ctx.lanes[0].alerts_kept = 0;
+        // hand the output buffer to the piece and start a fresh one
+        piece->out = ob->data;
+        piece->out_ct = ob->ct;
+        ob->data = malloc(sizeof(char) * WW_OUTBUFSIZE);
+        ob->ct = 0;
+        ob->size = WW_OUTBUFSIZE;
+
+        pthread_mutex_lock(&job->lock);
+        piece->done = 1;
+        pthread_cond_broadcast(&job->piece_done);
+    }
+    stats_add(&job->in_stats, &ctx.stats);
+    stats_add(&job->out_stats, &ob->stats);
+    pthread_mutex_unlock(&job->lock);
+    ww_destroy(&ctx);
+    return NULL;
+}
+
+/* ww_process_split: wrap the regular file fd_in to the output of ctx on jobs
+ * threads by cutting it at paragraph boundaries into pieces of roughly
+ * SPLIT_SIZE bytes. Output is byte-identical to ww_process_fd. Files that
+ * cannot be mapped or have no paragraph break to cut at, and contexts with
+ * more than one lane, are wrapped serially.
+ * Returns the same values as ww_process_fd
+ */
+int ww_process_split(struct ww_ctx *ctx, int fd_in, int jobs)
+{
+    struct stat st;
+    char *map;
+    size_t size, pos, cut;
+    struct split_job job;
+    pthread_t *workers;
+    int cap = 16;
+    int return_value = 1;
+    // newline chars in the pieces written so far
+    long long line = 0;
+    if (ctx->lane_ct > 1 || fstat(fd_in, &st) || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_in, 0)) == MAP_FAILED) {
+        return ww_process_fd(ctx, fd_in);
+    }
+    size = st.st_size;
+    // a compressed stream cannot be cut; it is decompressed serially
+    if (ctx->decompress && ww_format(map, size) != WW_PLAIN) {
+        munmap(map, size);
+        return ww_process_fd(ctx, fd_in);
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    // collect the cut points
+    job.pieces = malloc(sizeof(struct split_piece) * cap);
+    job.piece_ct = 0;
+    pos = 0;
+    while (pos < size) {
+        cut = pos + SPLIT_SIZE;
+        cut = cut < size ? find_paragraph(map, size, cut, ctx->utf8) : size;
+        if (job.piece_ct == cap) {
+            cap *= 2;
+            job.pieces = realloc(job.pieces, sizeof(struct split_piece) * cap);
+        }
+        job.pieces[job.piece_ct].start = map + pos;
+        job.pieces[job.piece_ct].len = cut - pos;
+        job.pieces[job.piece_ct].done = 0;
+        job.piece_ct++;
+        pos = cut;
+    }
+    // no paragraph break to cut at: nothing to gain from threads
+    if (job.piece_ct == 1) {
+        free(job.pieces);
+        if (ww_feed(ctx, map, size) == -2) {
+            ww_reset(ctx);
+            return_value = -2;
+        }
+        else {
+            return_value = ww_finish(ctx);
+        }
+        munmap(map, size);
+        return return_value;
+    }
+    job.next = 0;
+    job.written = 0;
+    job.window = jobs * SPLIT_WINDOW;
+    job.col_width = ctx->lanes[0].col_width;
+    job.optimal = ctx->optimal;
+    job.utf8 = ctx->utf8;
+    job.max_alerts = ctx->max_alerts;
+    job.quiet_alerts = ctx->quiet_alerts;
+    memset(&job.in_stats, 0, sizeof(struct ww_stats));
+    memset(&job.out_stats, 0, sizeof(struct ww_stats));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.piece_done, NULL);
+    pthread_cond_init(&job.piece_written, NULL);
+    workers = malloc(sizeof(pthread_t) * jobs);
+    for (int t = 0; t < jobs; t++) {
+        pthread_create(&workers[t], NULL, split_worker, &job);
+    }
+    // write the pieces in order as they are finished
+    for (int k = 0; k < job.piece_ct; k++) {
+        struct split_piece *piece = &job.pieces[k];
+        pthread_mutex_lock(&job.lock);
+        while (!piece->done) {
+            pthread_cond_wait(&job.piece_done, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+        if (piece->result < 0 && return_value != -2) {
+            return_value = piece->result;
+        }
+        if (return_value != -2 && outbuf_write(&ctx->lanes[0].ob, piece->out, piece->out_ct)) {
+            return_value = -2;
+        }
+        alerts_merge(&ctx->lanes[0], piece, line, job.max_alerts);
+        line += piece->lines;
+        free(piece->out);
+        free(piece->alerts);
+        pthread_mutex_lock(&job.lock);
+        job.written = k + 1;
+        pthread_cond_broadcast(&job.piece_written);
+        pthread_mutex_unlock(&job.lock);
+    }
+    if (return_value != -2 && outbuf_end(&ctx->lanes[0].ob)) {
+        return_value = -2;
+    }
+    if (ctx->lanes[0].ob.enc) encoder_reset(ctx->lanes[0].ob.enc);
+    for (int t = 0; t < jobs; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    stats_add(&ctx->stats, &job.in_stats);
+    stats_add(&ctx->lanes[0].ob.stats, &job.out_stats);
+    alerts_report(ctx);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.piece_done);
+    pthread_cond_destroy(&job.piece_written);
+    free(job.pieces);
+    munmap(map, size);
+    return return_value;
+}
@@ -0,0 +1,247 @@
+#ifndef LIBWW_H
+#define LIBWW_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* libww: the word wrapping engine behind ww
+ *
+ * A ww_ctx holds everything needed to wrap one document at a time: the
+ * parser state, the partial word carried between input buffers and one lane
+ * per column width. Each lane tracks its own lines and has its own output
+ * buffer, so a document is parsed once however many widths it is wrapped to.
+ * Contexts share nothing, so each thread can own one.
+ *
+ * Push interface:
+ *   ww_init(&ctx, col_width, outbuf_size)   once
+ *   ww_add_lane(&ctx, col_width, outbuf_size) for each further width
+ *   ww_set_fd / ww_set_sink / ww_set_memory choose where the output of the
+ *                                           first lane goes, ww_set_lane_fd
+ *                                           and ww_set_lane_sink that of any lane
+ *   ww_feed(&ctx, bytes, n)                 any number of times, any sizes
+ *   ww_finish(&ctx)                         ends the document; the context is
+ *                                           ready for the next one
+ *   ww_destroy(&ctx)                        once
+ * ww_process_fd and ww_process_split wrap a whole file descriptor.
+ * ww_feed_input is ww_feed for input that may be compressed: the first bytes
+ * of each document say whether it is gzip (or zstd, in a build with HAVE_ZSTD)
+ * and if so it is decompressed as it is fed. ww_process_fd feeds through it.
+ * ww_set_lane_compress makes a lane write its output compressed.
+ *
+ * Return values follow ww's exit status rules, taking the worst over all
+ * lanes (ww_finish leaves each lane's own in lanes[k].result):
+ *  1: document wrapped with no errors
+ * -1: document wrapped, but contains a word longer than col_width (an ALERT
+ *     message has been printed to stderr, unless quiet_alerts is set)
+ * -2: read or write error; an ERROR message has been printed to stderr and
+ *     the rest of the document was abandoned. A lane whose output fails is
+ *     dropped while the others carry on; ww_feed returns -2 once none is left
+ */
+
+#define WW_BUFSIZE 65536
+#define WW_OUTBUFSIZE 65536
+// chars of a long word shown in an ALERT; longer words are cut off with "..."
+#define WW_ALERT_SHOW 60
+
+// compression formats, as returned by ww_format and taken by ww_set_lane_compress
+#define WW_PLAIN 0
+#define WW_GZIP 1
+#define WW_ZSTD 2
+
+// a sink receives wrapped output and behaves like write(): it returns the
+// number of bytes it took, or -1 with errno set
+typedef ssize_t (*ww_sink)(void *arg, const char *buf, size_t n);
+
+// ww_stats counts what a context has done since ww_init; the numbers of one
+// document are the difference of copies taken before and after it. The input
+// side (bytes_in, reads, words) is kept in ww_ctx.stats, the output side of
+// each lane in its ww_outbuf.stats
+struct ww_stats {
+    long long bytes_in;
+    // read() calls made by ww_process_fd; a mapped input (use_mmap, and the
+    // pieces of ww_process_split) takes none, so it counts 0
+    long long reads;
+    long long words;
+    // bytes taken by the sink or write(), and calls made to it
+    long long bytes_out;
+    long long writes;
+    // lines and paragraphs ended, ALERTs printed
+    long long lines;
+    long long paragraphs;
+    long long alerts;
+};
+
+// stream state of a compressed input or output, private to libww.c
+struct ww_decoder;
+struct ww_encoder;
+
+// ww_outbuf collects output bytes so that the sink is called once per flush
+// instead of once per word, space or newline; size is the flush threshold.
+// With no sink the bytes go to write(fd). An in_memory outbuf never flushes:
+// it grows to hold everything written to it, and the owner takes the ct bytes
+// at data and resets ct. With an encoder, flushed bytes are compressed on
+// their way to the sink or fd, and stats count the compressed bytes
+struct ww_outbuf {
+    ww_sink sink;
+    void *arg;
+    int fd;
+    char *data;
+    int ct;
+    int size;
+    int in_memory;
+    struct ww_stats stats;
+    struct ww_encoder *enc;
+};
+
+// ww_word is a resizable block of chars that holds the part of a word read
+// so far when the word crosses the end of an input buffer; words that lie
+// entirely inside a buffer are written straight from the buffer
+struct ww_word {
+    char *chars;
+    int ct;
+    int size;
+};
+
+// ww_para holds the paragraph being collected in optimal mode: the words
+// with one space after each, and in off[k] the offset of word k in chars, so
+// that words i..j-1 form the line chars[off[i]] .. chars[off[j] - 2]. col[k]
+// is the column word k would start at if the paragraph were one line (cols
+// columns so far), so that line is col[j] - col[i] - 1 columns wide; without
+// ctx->utf8, col and off are the same. The other arrays are scratch space for
+// the line breaker, grown along with off
+struct ww_para {
+    char *chars;
+    int ct;
+    int size;
+    int *off;
+    int *col;
+    int cols;
+    int words;
+    int words_size;
+    double *cost;
+    int *brk;
+    int *queue;
+    int *queue_start;
+};
+
+// ww_alert is a word longer than col_width, kept to be shown in the report
+// at the end of the document: its first chars (cut is set if there are more),
+// its width and its input line
+struct ww_alert {
+    char word[WW_ALERT_SHOW + 1];
+    int cut;
+    int len;
+    long long line;
+};
+
+// ww_lane is the output side of one column width
+struct ww_lane {
+    int col_width;
+    // keep track of how many chars (including whitespace) have been written to a line so far
+    int line_char_ct;
+    // status of the document in progress, and of the last one ww_reset ended
+    int return_value;
+    int result;
+    struct ww_outbuf ob;
+    struct ww_para para;
+    // words longer than col_width in the document in progress: how many, the
+    // longest, and the first ctx->max_alerts of them
+    long long alert_ct;
+    struct ww_alert longest;
+    struct ww_alert *alerts;
+    int alerts_kept;
+};
+
+struct ww_ctx {
+    // parser state, reset by ww_finish
+    int BOF;
+    // newline chars seen since the last word ended
+    int newline_chars;
+    // newline chars that precede the word currently being parsed
+    int prev_newline_chars;
+    // set while the current word continues past the end of the input buffer
+    int in_word;
+    // terminate the output with a newline if the input had any words
+    int terminate;
+    // -2 after a read error, 1 otherwise
+    int return_value;
+    struct ww_word word;
+    struct ww_lane *lanes;
+    int lane_ct;
+    // optimal mode: instead of filling each line greedily, collect each
+    // paragraph in the lane's para and break it to minimize the sum over all
+    // lines but the last of (col_width - line length)^2. Set before the first
+    // ww_feed
+    int optimal;
+    // input strategy of ww_process_fd: size of the read() buffer (set before
+    // the first call; the buffer is kept for later files), and whether regular
+    // files are mapped instead of read
+    int bufsize;
+    int use_mmap;
+    char *readbuf;
+    // ww_feed_input decompresses documents that start with the magic number
+    // of a supported format, unless decompress is 0 (it is 1 after ww_init).
+    // bytes_in in stats counts the text after decompression
+    int decompress;
+    struct ww_decoder *decoder;
+    struct ww_stats stats;
+    // long word reporting. With max_alerts -1 (the default) an ALERT is printed
+    // for every long word as it is found. With max_alerts n >= 0 the long
+    // words of a document are collected and reported when it ends: the first n
+    // of them, then a total if there were more than one. quiet_alerts prints
+    // nothing at all. name, if not NULL, names the document in the messages.
+    // Return values are the same in every case
+    int max_alerts;
+    int quiet_alerts;
+    const char *name;
+    // newline chars of the document read so far
+    long long line;
+    // set on the contexts of ww_process_split's workers, whose long words are
+    // reported by the caller's context instead
+    int keep_alerts;
+    // UTF-8 mode: count columns instead of bytes, with East Asian wide chars
+    // taking 2 and combining marks 0, and break at Unicode whitespace as well.
+    // Buffers without a byte >= 0x80 take the byte path all the same. pend
+    // holds a char cut off by the end of the last buffer. Set before the
+    // first ww_feed
+    int utf8;
+    char pend[4];
+    int pend_ct;
+};
+
+void ww_init(struct ww_ctx *ctx, int col_width, int outbuf_size);
+void ww_destroy(struct ww_ctx *ctx);
+void ww_reset(struct ww_ctx *ctx);
+int ww_add_lane(struct ww_ctx *ctx, int col_width, int outbuf_size);
+
+void ww_set_fd(struct ww_ctx *ctx, int fd);
+void ww_set_sink(struct ww_ctx *ctx, ww_sink sink, void *arg);
+void ww_set_memory(struct ww_ctx *ctx);
+void ww_set_lane_fd(struct ww_ctx *ctx, int lane, int fd);
+void ww_set_lane_sink(struct ww_ctx *ctx, int lane, ww_sink sink, void *arg);
+
+int ww_feed(struct ww_ctx *ctx, const char *buf, size_t n);
+int ww_feed_input(struct ww_ctx *ctx, const char *buf, size_t n);
+int ww_finish(struct ww_ctx *ctx);
+
+int ww_process_fd(struct ww_ctx *ctx, int fd_in);
+int ww_process_split(struct ww_ctx *ctx, int fd_in, int jobs);
+
+// the compression format whose magic number starts the n bytes at buf, or
+// WW_PLAIN; formats this build cannot decompress are reported all the same
+int ww_format(const char *buf, size_t n);
+// compress the output of the given lane with format from the next document
+// on (WW_PLAIN turns it off); -1 if this build does not support format
+int ww_set_lane_compress(struct ww_ctx *ctx, int lane, int format);
+
+// UTF-8 helpers behind ctx->utf8: the columns the n bytes at s take (a byte
+// that is not valid UTF-8 takes 1), and the length in bytes of the whitespace
+// char at p, ASCII or not, or 0 if p does not start with one
+int ww_utf8_width(const char *s, size_t n);
+int ww_utf8_space(const char *p, size_t n);
+
+// select the whitespace scanner shared by all contexts: "scalar", "sse2",
+// "avx2", or NULL for the widest one the CPU supports; -1 if unsupported
+int ww_set_scanner(const char *name);
+
+#endif
@@ -1,13 +1,23 @@
+#define _XOPEN_SOURCE 700
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <locale.h>
+#include <wchar.h>
+#include <wctype.h>
 
 /* test_ww
  *
  * arguments
+ * 0. (optional) --optimal if the output was wrapped by ww --optimal, which
+ *    breaks lines early on purpose: skips check 4 below; --utf8 if it was
+ *    wrapped by ww --utf8: line lengths are then counted in display columns
+ *    and Unicode whitespace is whitespace. The C library's UTF-8 locale
+ *    decides both (wcwidth, iswspace), not libww, so a mistake in ww's tables
+ *    shows up as an error here
  * 1. col_width to which output file was wrapped
  * 2. name of output file to be tested
  * 3. (optional) name of original input file to be compared to output file
@@ -20,54 +30,149 @@
  * 4. line(s) wrapped too soon, based on col_width
  * 5. line(s) overran col_width
  * 6. line(s) contain whitespace chars other than space and newline
- * 7. (optional) input and output files do not contain the same non-whitespace chars
+ * 7. (optional) input and output files do not contain the same non-whitespace chars;
+ *    the byte offset and line of the first difference in each file is reported
  */
 
-#define HOLDER_SIZE_INIT 500
-#define BUFSIZE 16
+#define BUFSIZE 65536
 
-struct char_holder {
-    char *chars;
+/* The non-whitespace chars of the two files are compared as the output file
+ * is read: each one taken from the output is matched against the next one
+ * read_non_ws takes from the input, so memory use stays at two buffers no
+ * matter how large the files are.
+ */
+struct input_stream {
+    int fd;
+    char buf[BUFSIZE];
+    int pos;
     int ct;
+    // set once read() has returned 0
+    int eof;
+    // position of the char last returned by read_non_ws, counted from 1
+    long long offset;
+    long long line;
+    // line the next char is on
+    long long next_line;
 };
 
-struct char_holder nonws_in, nonws_out;
-int ch_size = HOLDER_SIZE_INIT;
+struct input_stream in_stream;
+// set by --optimal: lines may be wrapped before they are full
+int optimal = 0;
+// set by --utf8: count columns and whitespace as ww --utf8 does
+int utf8 = 0;
+
+// decode the char at p (n > 0 bytes) into *wc and return its length. In
+// --utf8 mode that is a complete UTF-8 sequence; a byte that does not start
+// one is a char of its own with *wc -1, as is every byte otherwise
+int decode(const char *p, int n, long *wc) {
+    mbstate_t state;
+    wchar_t c;
+    size_t len;
+    *wc = -1;
+    if (!utf8) return 1;
+    memset(&state, 0, sizeof(state));
+    len = mbrtowc(&c, p, n, &state);
+    if (len == (size_t)-1 || len == (size_t)-2) return 1;
+    *wc = c;
+    return len == 0 ? 1 : (int)len;
+}
+
+// length of the whitespace char at p (n > 0 bytes), 0 if it is not one
+int space_len(const char *p, int n) {
+    long wc;
+    int len = decode(p, n, &wc);
+    if (!utf8) return isspace((unsigned char)p[0]) ? 1 : 0;
+    // ww takes U+0085 (NEL) as a newline; iswspace does not
+    return wc >= 0 && (wc == 0x85 || iswspace(wc)) ? len : 0;
+}
+
+// length of the char at p (n > 0 bytes)
+int char_len(const char *p, int n) {
+    long wc;
+    return decode(p, n, &wc);
+}
+
+// columns taken by the len bytes of one char at p: wcwidth's answer in --utf8
+// mode, 1 for an invalid byte, a control char or a char wcwidth has no width for
+int char_width(const char *p, int len) {
+    long wc;
+    int width;
+    decode(p, len, &wc);
+    // ww joins the emoji skin tone modifiers to the emoji before them
+    if (wc >= 0x1F3FB && wc <= 0x1F3FF) return 0;
+    if (wc < 0x20 || (width = wcwidth(wc)) < 0) return 1;
+    return width;
+}
 
-void add_char(struct char_holder *ch, char c)
-{
-    // resize char_holders if necessary
-    // have to resize both char-holders--not the greatest design
-    if (ch->ct == ch_size) {
-        ch_size *= 2;
-        nonws_in.chars = realloc(nonws_in.chars, ch_size * sizeof(char));
-        nonws_out.chars = realloc(nonws_out.chars, ch_size * sizeof(char));
+// length of a UTF-8 char cut off by the end of the n bytes at p, 0 if none
+int cut_len(const char *p, int n) {
+    for (int back = 1; back <= 3 && back <= n; back++) {
+        unsigned char c = p[n - back];
+        if ((c & 0xC0) != 0x80) {
+            int len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            return len > back ? back : 0;
+        }
     }
-    ch->chars[ch->ct] = c;
-    ch->ct++;
+    return 0;
 }
 
-int read_non_ws(int fd) {
-    char buf[BUFSIZE];
-    int bytes_read;
-    while ((bytes_read = read(fd, buf, BUFSIZE)) > 0) {
-        for (int i = 0; i < bytes_read; i++) {
-            if (!isspace(buf[i])) {
-                add_char(&nonws_in, buf[i]);
+// return the next byte of a non-whitespace char of the input file, EOF at the
+// end of the file, or -2 on a read error
+int read_non_ws(struct input_stream *in) {
+    for (;;) {
+        // keep a whole UTF-8 char in the buffer, so that it can be classified
+        if (in->ct - in->pos < 4 && !in->eof) {
+            int left = in->ct - in->pos;
+            memmove(in->buf, in->buf + in->pos, left);
+            in->pos = 0;
+            in->ct = left;
+            int bytes_read = read(in->fd, in->buf + left, BUFSIZE - left);
+            if (bytes_read < 0) {
+                perror("Input file read error");
+                in->ct = 0;
+                in->eof = 1;
+                return -2;
             }
+            if (bytes_read == 0) in->eof = 1;
+            in->ct += bytes_read;
+            continue;
+        }
+        if (in->pos == in->ct) return EOF;
+        unsigned char c = in->buf[in->pos];
+        int len = space_len(in->buf + in->pos, in->ct - in->pos);
+        in->line = in->next_line;
+        in->offset++;
+        if (len == 0) {
+            in->pos++;
+            return c;
         }
+        if (c == '\n') in->next_line++;
+        in->offset += len - 1;
+        in->pos += len;
     }
-    // make this a string by adding a null terminator
-    if (bytes_read == 0) {
-        add_char(&nonws_in, '\0');
+}
+
+void report_mismatch(long long out_offset, int out_line, struct input_stream *in, int in_ended) {
+    fprintf(stderr, "Input and output files do not contain the same non-whitespace chars\n");
+    if (out_offset == 0) {
+        fprintf(stderr, "first difference: output ends, input byte %lld (line %lld)\n",
+            in->offset, in->line);
     }
-    else if (bytes_read < 0) {
-        perror("Input file read error");
+    else if (in_ended) {
+        fprintf(stderr, "first difference: output byte %lld (line %d), input ends\n",
+            out_offset, out_line);
+    }
+    else {
+        fprintf(stderr, "first difference: output byte %lld (line %d), input byte %lld (line %lld)\n",
+            out_offset, out_line, in->offset, in->line);
     }
-    return bytes_read;
 }
 
-int process_output(int fd, int col_width) {
+/* process_output: check the output file against the spec, and when in is not
+ * NULL, compare its non-whitespace chars with those of the input file.
+ * Returns -1 if any error was found
+ */
+int process_output(int fd, int col_width, struct input_stream *in) {
     char buf[BUFSIZE];
     int bytes_read;
     int BOF = 1;
@@ -77,19 +182,45 @@ int process_output(int fd, int col_width) {
     int consec_newlines = 0;
     int consec_spaces = 0;
     int return_value = 0;
+    long long offset = 0;
+    // set once the first difference from the input has been reported
+    int mismatch = 0;
+    // bytes of a UTF-8 char cut off by the end of the last read, kept at the
+    // start of buf
+    int have = 0;
 
-    while ((bytes_read = read(fd, buf, BUFSIZE)) > 0) {
-        for (int i = 0; i < bytes_read; i++) {
+    while ((bytes_read = read(fd, buf + have, BUFSIZE - have)) > 0 || have > 0) {
+        int n = have + (bytes_read > 0 ? bytes_read : 0);
+        int end = n;
+        int len;
+        // leave a cut char for the next read, unless the file has ended
+        if (utf8 && bytes_read > 0) end -= cut_len(buf, n);
+        for (int i = 0; i < end; i += len) {
+            int ws = space_len(buf + i, end - i);
+            len = ws ? ws : char_len(buf + i, end - i);
+            offset += len;
             // Correct output files cannot begin with whitespace
-            if (BOF && isspace(buf[i])) {
+            if (BOF && ws) {
                 fprintf(stderr, "Output file error: file begins with whitespace\n");
                 return_value = -1;
             }
             BOF = 0;
-            if (!isspace(buf[i])) {
-                add_char(&nonws_out, buf[i]);
-                word_char_ct++;
-                line_char_ct++;
+            if (!ws) {
+                for (int k = 0; in && !mismatch && k < len; k++) {
+                    int c = read_non_ws(in);
+                    if (c == -2) {
+                        mismatch = 1;
+                        return_value = -1;
+                    }
+                    else if (c != (unsigned char)buf[i + k]) {
+                        report_mismatch(offset - len + k + 1, line_num, in, c == EOF);
+                        mismatch = 1;
+                        return_value = -1;
+                    }
+                }
+                int width = char_width(buf + i, len);
+                word_char_ct += width;
+                line_char_ct += width;
                 consec_newlines = 0;
                 consec_spaces = 0;
             }
@@ -98,7 +229,7 @@ int process_output(int fd, int col_width) {
                     fprintf(stderr, "Output file error: line %d has multiple spaces\n", line_num);
                     return_value = -1;
                 }
-                if (prev_line_char_ct > 0 && 
+                if (!optimal && prev_line_char_ct > 0 && 
                     prev_line_char_ct + 1 + word_char_ct <= col_width) {
                     fprintf(stderr, "Output file error: line %d wrapped too soon\n", line_num - 1);
                     return_value = -1;
@@ -127,15 +258,25 @@ int process_output(int fd, int col_width) {
                     return_value = -1;
             }
         }
+        memmove(buf, buf + end, n - end);
+        have = n - end;
+        if (bytes_read <= 0) break;
     }
-    // need to null-terminate the char holder to create a string
-    if (bytes_read == 0) {
-        add_char(&nonws_out, '\0');
-    }
-    else if (bytes_read < 0) {
+    if (bytes_read < 0) {
         perror("Output file read error");
         return_value = -1;
     }
+    // the input must not have non-whitespace chars left over
+    else if (in && !mismatch) {
+        int c = read_non_ws(in);
+        if (c == -2) {
+            return_value = -1;
+        }
+        else if (c != EOF) {
+            report_mismatch(0, line_num, in, 0);
+            return_value = -1;
+        }
+    }
     return return_value;
 }
 
@@ -143,19 +284,26 @@ int main(int argc, char **argv) {
     int fd_in = -1, fd_out = -1;
     int col_width;
     int fail_check = EXIT_SUCCESS;
-    nonws_in.chars = malloc(sizeof(char) * HOLDER_SIZE_INIT);
-    nonws_in.ct = 0;
-    nonws_out.chars = malloc(sizeof(char) * HOLDER_SIZE_INIT);
-    nonws_out.ct = 0;
 
+    while (argc > 1 && (!strcmp(argv[1], "--optimal") || !strcmp(argv[1], "--utf8"))) {
+        if (!strcmp(argv[1], "--optimal")) optimal = 1;
+        else utf8 = 1;
+        argc--;
+        argv++;
+    }
+    // --utf8 takes its rules from a UTF-8 locale
+    if (utf8 && !setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8")) {
+        fprintf(stderr, "test_ww: --utf8 needs the C.UTF-8 or en_US.UTF-8 locale\n");
+        return EXIT_FAILURE;
+    }
     if (argc < 3) {
-        fprintf(stderr, "usage: ./test_ww col_width output_file [input_file]\n");
+        fprintf(stderr, "usage: ./test_ww [--optimal] [--utf8] col_width output_file [input_file]\n");
         fail_check = EXIT_FAILURE;
     }
     else {
         col_width = atoi(argv[1]);
         if (col_width < 1) {
-            fprintf(stderr, "usage: ./test_ww col_width output_file [input_file]\n");
+            fprintf(stderr, "usage: ./test_ww [--optimal] [--utf8] col_width output_file [input_file]\n");
             fprintf(stderr, "col_width must be a positive integer\n");
             fail_check = EXIT_FAILURE;
         }
@@ -169,23 +317,18 @@ int main(int argc, char **argv) {
             fail_check = EXIT_FAILURE;
         }
         else {
-            // read all non-whitespace chars from input file
-            if (argc > 3 && read_non_ws(fd_in) < 0) fail_check = EXIT_FAILURE;
-            // read all chars from output file
-            if (process_output(fd_out, col_width) < 0) fail_check = EXIT_FAILURE;
-            // test for identical non-whitespace chars
-            if (argc > 3 && (nonws_in.ct != nonws_out.ct ||
-                (nonws_in.ct == nonws_out.ct && strncmp(nonws_in.chars, nonws_out.chars, nonws_in.ct)))) {        
-                fprintf(stderr, "Input and output files do not contain the same non-whitespace chars\n");
-                fail_check = EXIT_FAILURE;
+            struct input_stream *in = NULL;
+            if (argc > 3) {
+                in = &in_stream;
+                in->fd = fd_in;
+                in->next_line = 1;
             }
+            // read all chars from output file, comparing with the input file as we go
+            if (process_output(fd_out, col_width, in) < 0) fail_check = EXIT_FAILURE;
         }
     }    
     // close files
     if (fd_in >= 0) close(fd_in);
     if (fd_out >= 0) close(fd_out);
-    // free memory
-    free(nonws_in.chars);
-    free(nonws_out.chars);
     return fail_check;
 }
\ No newline at end of file
@@ -1,348 +1,2018 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <ctype.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define WW_URING 1
+#endif
+#endif
+#include "libww.h"
 
 #define DEBUG 0
-#define BUFSIZE 8
-#define WORDSIZE_INIT 16
+#define USAGE "usage: ./ww [--bufsize bytes] [--mmap] [--outbufsize bytes] " \
+    "[--scanner scalar|sse2|avx2] [-j jobs] [-r] [--incremental] [--uring] [--split] " \
+    "[--optimal] [--utf8] [--files-from list [-0]] [--stats fd | --stats-json fd] " \
+    "[--max-alerts n] [--quiet] [--watch] [--compress gzip|zstd] [--no-decompress] " \
+    "col_width[,col_width...] [filename | dirname]...\n"
+
+// I/O strategy, set once from the command line: size of the read() buffer,
+// whether regular files are mapped instead of read, and the flush threshold
+// of every output buffer
+int read_bufsize = WW_BUFSIZE;
+int use_mmap = 0;
+int outbuf_size = WW_OUTBUFSIZE;
+// break paragraphs for minimum raggedness instead of greedily (--optimal)
+int optimal = 0;
+// count display columns of UTF-8 text instead of bytes (--utf8)
+int utf8 = 0;
+// skip files whose wrap.* output is up to date (--incremental)
+int incremental = 0;
+// wrap directory entries on the io_uring backend when there are no workers (--uring)
+int use_uring = 0;
+// where --stats or --stats-json send statistics, -1 for nowhere
+int stats_fd = -1;
+int stats_json = 0;
+// long words shown per file and width (--max-alerts), or none at all (--quiet)
+int max_alerts = 10;
+int quiet_alerts = 0;
+// format every output is compressed with (--compress), and the suffix out_name
+// adds to the names of output files
+int compress_out = WW_PLAIN;
+const char *compress_suffix = "";
+// decompress input that starts with a gzip or zstd magic number, unless
+// --no-decompress asks for its bytes to be wrapped as they are
+int decompress = 1;
+
+// files wrapped and files found up to date by the directory walk, for the
+// --incremental summary; guarded by count_lock since workers update them
+int wrapped_ct = 0, skipped_ct = 0;
+pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the column widths from the command line; with more than one, file and
+// directory mode write one output per width, named by out_name
+int *widths = NULL;
+int width_ct = 0;
+
+// set up a wrapping context with a lane for each width and the I/O strategy
+// from the command line
+void ctx_init(struct ww_ctx *ctx)
+{
+    ww_init(ctx, widths[0], outbuf_size);
+    for (int k = 1; k < width_ct; k++) {
+        ww_add_lane(ctx, widths[k], outbuf_size);
+    }
+    ctx->bufsize = read_bufsize;
+    ctx->use_mmap = use_mmap;
+    ctx->optimal = optimal;
+    ctx->utf8 = utf8;
+    ctx->decompress = decompress;
+    ctx->max_alerts = max_alerts;
+    ctx->quiet_alerts = quiet_alerts;
+    for (int k = 0; k < width_ct; k++) {
+        ww_set_lane_compress(ctx, k, compress_out);
+    }
+}
+
+/* Statistics (--stats fd, --stats-json fd)
+ * Each wrapped file is measured by the difference of its context's counters
+ * (see struct ww_stats) before and after it, summed over all widths, and by
+ * the time from deciding to wrap it to closing its outputs. --stats-json
+ * writes one JSON object per line to fd for every file, then one with the
+ * totals of the run; --stats writes only a human-readable summary at the end.
+ * Records are written whole with a single write() and the totals are kept
+ * under stats_lock, since -j workers finish files concurrently.
+ */
+struct run_stats {
+    struct ww_stats sum;
+    long long files;
+    long long alerted;
+    long long failed;
+    struct timespec start;
+    double slowest;
+    char *slowest_name;
+};
+
+struct run_stats run_stats;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the counters of ctx, its input side plus the output side of every lane
+void stats_take(struct ww_stats *s, const struct ww_ctx *ctx)
+{
+    *s = ctx->stats;
+    for (int k = 0; k < ctx->lane_ct; k++) {
+        const struct ww_stats *o = &ctx->lanes[k].ob.stats;
+        s->bytes_out += o->bytes_out;
+        s->writes += o->writes;
+        s->lines += o->lines;
+        s->paragraphs += o->paragraphs;
+        s->alerts += o->alerts;
+    }
+}
+
+// replace s, taken with stats_take before a file, by what ctx counted since
+void stats_since(struct ww_stats *s, const struct ww_ctx *ctx)
+{
+    struct ww_stats now;
+    stats_take(&now, ctx);
+    s->bytes_in = now.bytes_in - s->bytes_in;
+    s->reads = now.reads - s->reads;
+    s->words = now.words - s->words;
+    s->bytes_out = now.bytes_out - s->bytes_out;
+    s->writes = now.writes - s->writes;
+    s->lines = now.lines - s->lines;
+    s->paragraphs = now.paragraphs - s->paragraphs;
+    s->alerts = now.alerts - s->alerts;
+}
+
+double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+        else if (*c < 0x20) fprintf(fp, "\\u%04x", *c);
+        else fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+void json_counters(FILE *fp, const struct ww_stats *s, double seconds)
+{
+    fprintf(fp, "\"bytes_in\":%lld,\"bytes_out\":%lld,\"words\":%lld,\"lines\":%lld,"
+        "\"paragraphs\":%lld,\"alerts\":%lld,\"reads\":%lld,\"writes\":%lld,"
+        "\"seconds\":%.6f}\n", s->bytes_in, s->bytes_out, s->words, s->lines,
+        s->paragraphs, s->alerts, s->reads, s->writes, seconds);
+}
+
+// write the ct bytes at buf to stats_fd, retrying short writes
+void stats_write(const char *buf, size_t ct)
+{
+    ssize_t n;
+    while (ct > 0 && (n = write(stats_fd, buf, ct)) > 0) {
+        buf += n;
+        ct -= n;
+    }
+}
+
+void stats_start(void)
+{
+    memset(&run_stats, 0, sizeof(run_stats));
+    clock_gettime(CLOCK_MONOTONIC, &run_stats.start);
+}
+
+/* stats_file: account for the file named file, which took seconds and whose
+ * counters are in s; result is the worst status over its outputs, as in
+ * ww_ctx.lanes[k].result (-2 also when it could not be opened)
+ */
+void stats_file(const char *file, const struct ww_stats *s, double seconds, int result)
+{
+    char *buf = NULL;
+    size_t ct = 0;
+    FILE *fp;
+    if (stats_fd < 0) return;
+    pthread_mutex_lock(&stats_lock);
+    run_stats.files++;
+    if (result == -1) run_stats.alerted++;
+    if (result == -2) run_stats.failed++;
+    run_stats.sum.bytes_in += s->bytes_in;
+    run_stats.sum.reads += s->reads;
+    run_stats.sum.words += s->words;
+    run_stats.sum.bytes_out += s->bytes_out;
+    run_stats.sum.writes += s->writes;
+    run_stats.sum.lines += s->lines;
+    run_stats.sum.paragraphs += s->paragraphs;
+    run_stats.sum.alerts += s->alerts;
+    if (stats_json) {
+        fp = open_memstream(&buf, &ct);
+        fputs("{\"file\":", fp);
+        json_string(fp, file);
+        fprintf(fp, ",\"status\":\"%s\",", result == 1 ? "ok" : result == -1 ? "alert" : "error");
+        json_counters(fp, s, seconds);
+        fclose(fp);
+        stats_write(buf, ct);
+        free(buf);
+    }
+    if (run_stats.slowest_name == NULL || seconds > run_stats.slowest) {
+        free(run_stats.slowest_name);
+        run_stats.slowest_name = strdup(file);
+        run_stats.slowest = seconds;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// write the totals of the run: a JSON object, or the human-readable summary
+void stats_finish(void)
+{
+    char *buf = NULL;
+    size_t ct = 0;
+    FILE *fp;
+    struct ww_stats *s = &run_stats.sum;
+    double seconds = seconds_since(&run_stats.start);
+    if (stats_fd < 0) return;
+    fp = open_memstream(&buf, &ct);
+    if (stats_json) {
+        fprintf(fp, "{\"total\":true,\"files\":%lld,\"up_to_date\":%d,\"alerted\":%lld,"
+            "\"failed\":%lld,", run_stats.files, skipped_ct, run_stats.alerted, run_stats.failed);
+        json_counters(fp, s, seconds);
+    }
+    else {
+        fprintf(fp, "ww: %lld files wrapped (%lld with ALERTs, %lld failed), %d up to date, "
+            "in %.3f s\n", run_stats.files, run_stats.alerted, run_stats.failed, skipped_ct,
+            seconds);
+        fprintf(fp, "ww: %lld bytes in, %lld bytes out, %.1f MB/s\n", s->bytes_in,
+            s->bytes_out, seconds > 0 ? s->bytes_in / seconds / (1024 * 1024) : 0.0);
+        fprintf(fp, "ww: %lld words, %lld lines, %lld paragraphs, %lld ALERTs\n", s->words,
+            s->lines, s->paragraphs, s->alerts);
+        fprintf(fp, "ww: %lld read calls, %lld write calls\n", s->reads, s->writes);
+        if (run_stats.slowest_name) {
+            fprintf(fp, "ww: slowest file %s (%.6f s)\n", run_stats.slowest_name,
+                run_stats.slowest);
+        }
+    }
+    fclose(fp);
+    stats_write(buf, ct);
+    free(buf);
+    free(run_stats.slowest_name);
+}
+
+// name of the output for lane k of the input name: "wrap.name" for a single
+// width, "wrap.<width>.name" for several. Compressed outputs get the suffix of
+// their format even if name has one already, so that "a" and "a.gz" never
+// share an output; the caller frees it
+char *out_name(int k, const char *name)
+{
+    int n = strlen(name) + strlen(compress_suffix) + 32;
+    char *file_name = (char *)malloc(n * sizeof(char));
+    if (width_ct == 1) {
+        snprintf(file_name, n, "wrap.%s%s", name, compress_suffix);
+    }
+    else {
+        snprintf(file_name, n, "wrap.%d.%s%s", widths[k], name, compress_suffix);
+    }
+    return file_name;
+}
+
+/* Atomic outputs
+ * An output is never written in place: it goes to a hidden temp file
+ * ".wrap.name.XXXXXX" in the same directory, which wrap_end renames over
+ * wrap.name once the output is complete. Readers see either the previous
+ * wrap.name or the new one, never a half-written file, and if wrapping fails
+ * the temp file is removed and the previous wrap.name is left as it was.
+ * Wrapping plain text never makes it longer than the input plus a final
+ * newline, so the temp file is preallocated with that many bytes up front
+ * instead of growing one flush at a time. For compressed input this is only a
+ * guess: the output grows past it as usual. Compressed outputs are not
+ * preallocated, since their size has little to do with that of the input.
+ * Whatever the output did not use is freed before the rename.
+ */
+// replace *tmp_name with a fresh temp name for the output file_name
+void temp_name(char **tmp_name, const char *file_name)
+{
+    static unsigned long tmp_ct = 0;
+    const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    int n = strlen(file_name) + 9;
+    unsigned long long v = __atomic_fetch_add(&tmp_ct, 1, __ATOMIC_RELAXED) *
+        0x9e3779b97f4a7c15ULL ^ (unsigned long long)getpid() << 32 ^ time(NULL);
+    *tmp_name = (char *)realloc(*tmp_name, n * sizeof(char));
+    snprintf(*tmp_name, n, ".%s.", file_name);
+    for (int i = n - 7; i < n - 1; i++) {
+        (*tmp_name)[i] = chars[v % 62];
+        v /= 62;
+    }
+    (*tmp_name)[n - 1] = '\0';
+}
 
-// word is a pointer to a resizable block of chars that builds the string of
-// non-whitespace chars that make up a word
-char *word;
-int word_char_ct = 0, word_size = WORDSIZE_INIT;
+// create a temp file for the output file_name in dir_fd, naming it in
+// *tmp_name; returns its descriptor, or -1 with errno set
+int temp_open(int dir_fd, char **tmp_name, const char *file_name)
+{
+    int fd;
+    do {
+        temp_name(tmp_name, file_name);
+    } while ((fd = openat(dir_fd, *tmp_name, O_WRONLY|O_CREAT|O_EXCL, S_IRWXU)) < 0 &&
+        errno == EEXIST);
+    return fd;
+}
 
-void add_char(char c)
+// reserve room for the wrap of an input of in_size bytes; this only saves
+// fragmentation, so file systems that cannot do it are ignored
+void out_prealloc(int fd, off_t in_size)
 {
-    // resize word if necessary
-    if (word_char_ct == word_size) {
-        word_size *= 2;
-        word = realloc(word, word_size * sizeof(char));
+    if (compress_out != WW_PLAIN) return;
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, in_size + 1);
+}
+
+// give back what out_prealloc reserved past the end of the finished output;
+// truncating to the current size frees blocks beyond it
+void out_trim(int fd)
+{
+    struct stat st;
+    if (compress_out != WW_PLAIN || fstat(fd, &st)) return;
+    ftruncate(fd, st.st_size);
+}
+
+/* Incremental mode (--incremental)
+ * After a clean wrap of name, ww records in the hidden file ".wrap.name" (or
+ * ".wrap.<width>.name", one per width) the
+ * column width, whether --optimal, --utf8 and --no-decompress were given, the
+ * --compress format, and the size and modification time of both name and wrap.name. A later run
+ * skips name if all of these still match: the input has not changed, nobody has
+ * touched wrap.name since, and the width, line breaking and format are the same. With several widths, name is skipped
+ * only if every output is up to date.
+ * Files whose wrap reported an error or ALERT are never recorded, so they are
+ * wrapped (and reported) again on every run.
+ */
+#define META_FORMAT "ww-meta 5 %d %d %d %d %d %lld %lld %ld %lld %lld %ld\n"
+
+// 1 if the record meta_name in dir_fd says out_name is an up-to-date wrap of
+// an input with stat in_stat by the given lane of ctx, 0 otherwise
+int meta_up_to_date(int dir_fd, const char *meta_name, const char *out_name,
+    const struct stat *in_stat, const struct ww_ctx *ctx, int lane)
+{
+    char buf[256];
+    int fd, n;
+    int m_width, m_optimal, m_utf8, m_decompress, m_compress;
+    long long m_in_size, m_in_sec, m_out_size, m_out_sec;
+    long m_in_nsec, m_out_nsec;
+    struct stat out_stat;
+    if ((fd = openat(dir_fd, meta_name, O_RDONLY)) < 0) return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    if (sscanf(buf, META_FORMAT, &m_width, &m_optimal, &m_utf8, &m_decompress, &m_compress,
+        &m_in_size, &m_in_sec, &m_in_nsec, &m_out_size, &m_out_sec, &m_out_nsec) != 11) {
+        return 0;
     }
-    word[word_char_ct] = c;
-    word_char_ct++;
+    if (fstatat(dir_fd, out_name, &out_stat, 0)) return 0;
+    return m_width == ctx->lanes[lane].col_width && m_optimal == ctx->optimal &&
+        m_utf8 == ctx->utf8 && m_decompress == ctx->decompress && m_compress == compress_out &&
+        m_in_size == in_stat->st_size && m_in_sec == in_stat->st_mtim.tv_sec &&
+        m_in_nsec == in_stat->st_mtim.tv_nsec &&
+        m_out_size == out_stat.st_size && m_out_sec == out_stat.st_mtim.tv_sec &&
+        m_out_nsec == out_stat.st_mtim.tv_nsec;
+}
+
+// record that the open file fd_out is a clean wrap of an input with stat
+// in_stat by the given lane of ctx; a failure only costs a re-wrap next time,
+// so it is not reported
+void meta_write(int dir_fd, const char *meta_name, const struct stat *in_stat,
+    int fd_out, const struct ww_ctx *ctx, int lane)
+{
+    struct stat out_stat;
+    int fd;
+    if (fstat(fd_out, &out_stat)) return;
+    if ((fd = openat(dir_fd, meta_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0) return;
+    dprintf(fd, META_FORMAT, ctx->lanes[lane].col_width, ctx->optimal, ctx->utf8,
+        ctx->decompress, compress_out,
+        (long long)in_stat->st_size,
+        (long long)in_stat->st_mtim.tv_sec, in_stat->st_mtim.tv_nsec,
+        (long long)out_stat.st_size, (long long)out_stat.st_mtim.tv_sec,
+        out_stat.st_mtim.tv_nsec);
+    close(fd);
 }
 
-/* Inform user of write() errors and writing fewer than bytes than requested
- * Return -1 if either of these situations is inferred from the arguments,
- * 0 otherwise
+// dir_ref keeps a directory open for as long as the walk or any queued entry
+// still needs its file descriptor; refs is guarded by the file_queue lock
+struct dir_ref {
+    int fd;
+    int refs;
+    // path of the directory as given, ending in "/" (empty for the current
+    // directory), for naming its files in statistics
+    char *path;
+};
+
+/* Wrapping one directory entry name of dir->fd into "wrap.name" in the same
+ * directory (one "wrap.<width>.name" per width when there are several) takes
+ * three steps, shared by wrap_file and the io_uring backend:
+ * wrap_begin: decide whether name needs wrapping. d_type is the type readdir
+ *     reported; DT_REG entries need no stat, anything else is looked up with
+ *     fstatat (following symlinks) and bypassed unless it is a regular file.
+ *     A caller that has already stat'ed a regular file passes that stat as st
+ *     (NULL otherwise), and it is used instead of a second lookup.
+ *     With --incremental, entries whose records say every output is up to date
+ *     are skipped. Returns -1 if an error was reported, 0 if there is nothing
+ *     to do, 1 if job is ready for wrap_fd (or the backend's equivalent)
+ * wrap_fd: open the outputs (as temp files), wrap the open input fd_in to them
+ *     and fill in job->results. Returns -1 if an error was reported, 0 otherwise
+ * wrap_end: move the complete outputs into place, record clean wraps, close
+ *     the outputs and free job. Returns -1 if an output could not be renamed
  */
-int inform_write_err(int requested, int written)
-{    
+struct wrap_job {
+    struct dir_ref *dir;
+    const char *name;
+    // name with the path of dir, for messages and statistics
+    char *path;
+    struct stat file_stat;
+    int lane_ct;
+    char **file_names;
+    char **meta_names;
+    // temp files the outputs are written to, named once they are opened
+    char **tmp_names;
+    int *fd_out;
+    // outputs opened so far; all lane_ct of them once the file was wrapped
+    int opened;
+    // ww_process_fd's result for each lane, as in ww_ctx.lanes[k].result
+    int *results;
+    // set when the outputs were found up to date and nothing was wrapped
+    int up_to_date;
+    // for --stats: what wrapping the file counted, and when it was started
+    struct ww_stats stats;
+    struct timespec start;
+};
+
+int wrap_end(struct wrap_job *job, const struct ww_ctx *ctx)
+{
+    int ret_value = 0;
+    int result = job->opened < job->lane_ct ? -2 : 1;
+    //replace wrap.filename with each output that was written in full; the
+    //others, and all of them if an output could not be opened, are dropped
+    for (int k = 0; k < job->opened; k++) {
+        if (job->opened < job->lane_ct || job->results[k] == -2) {
+            unlinkat(job->dir->fd, job->tmp_names[k], 0);
+        }
+        else {
+            out_trim(job->fd_out[k]);
+            if (renameat(job->dir->fd, job->tmp_names[k], job->dir->fd, job->file_names[k])) {
+                fprintf(stderr, "ERROR: %s: %s\n", job->file_names[k], strerror(errno));
+                unlinkat(job->dir->fd, job->tmp_names[k], 0);
+                job->results[k] = -2;
+                ret_value = -1;
+            }
+        }
+    }
+    //record clean wraps; anything else must be redone next time
+    if (job->opened == job->lane_ct) {
+        for (int k = 0; incremental && k < job->lane_ct; k++) {
+            if (job->results[k] == 1) {
+                meta_write(job->dir->fd, job->meta_names[k], &job->file_stat,
+                    job->fd_out[k], ctx, k);
+            }
+            else {
+                unlinkat(job->dir->fd, job->meta_names[k], 0);
+            }
+        }
+        pthread_mutex_lock(&count_lock);
+        wrapped_ct++;
+        pthread_mutex_unlock(&count_lock);
+        for (int k = 0; k < job->lane_ct; k++) {
+            if (job->results[k] < result) result = job->results[k];
+        }
+    }
+    //close open files
+    for (int k = 0; k < job->opened; k++) {
+        close(job->fd_out[k]);
+    }
+    if (!job->up_to_date && stats_fd >= 0) {
+        stats_file(job->path, &job->stats, seconds_since(&job->start), result);
+    }
+    //free memory allocated by malloc
+    for (int k = 0; k < job->lane_ct; k++) {
+        free(job->file_names[k]);
+        free(job->tmp_names[k]);
+        if (job->meta_names) free(job->meta_names[k]);
+    }
+    free(job->path);
+    free(job->file_names);
+    free(job->tmp_names);
+    free(job->meta_names);
+    free(job->fd_out);
+    free(job->results);
+    return ret_value;
+}
+
+int wrap_begin(struct wrap_job *job, struct dir_ref *dir, const char *name,
+    unsigned char d_type, const struct stat *st, const struct ww_ctx *ctx)
+{
+    int lane_ct = ctx->lane_ct;
+    int up_to_date = incremental;
+    if (st) {
+        job->file_stat = *st;
+    }
+    else if (d_type != DT_REG || incremental) {
+        //make sure stat returns no errors
+        if (fstatat(dir->fd, name, &job->file_stat, 0)){
+            fprintf(stderr, "ERROR: stat(%s): %s\n", name, strerror(errno));
+            return -1;
+        }
+        //bypass anything that is not a regular file
+        if (!S_ISREG(job->file_stat.st_mode))
+            return 0;
+    }
+    job->dir = dir;
+    job->name = name;
+    job->path = malloc(strlen(dir->path) + strlen(name) + 1);
+    strcpy(job->path, dir->path);
+    strcat(job->path, name);
+    job->lane_ct = lane_ct;
+    job->opened = 0;
+    job->meta_names = NULL;
+    //one output file per column width
+    job->file_names = (char **)malloc(lane_ct * sizeof(char *));
+    job->tmp_names = (char **)calloc(lane_ct, sizeof(char *));
+    for (int k = 0; k < lane_ct; k++) {
+        job->file_names[k] = out_name(k, name);
+    }
+    //leave the outputs alone if the records from the last run still match
+    if (incremental) {
+        job->meta_names = (char **)malloc(lane_ct * sizeof(char *));
+        for (int k = 0; k < lane_ct; k++) {
+            job->meta_names[k] = (char *)malloc((strlen(job->file_names[k]) + 2) * sizeof(char));
+            job->meta_names[k][0] = '.';
+            strcpy(job->meta_names[k] + 1, job->file_names[k]);
+            if (!meta_up_to_date(dir->fd, job->meta_names[k], job->file_names[k],
+                &job->file_stat, ctx, k)) {
+                up_to_date = 0;
+            }
+        }
+    }
+    job->fd_out = (int *)malloc(lane_ct * sizeof(int));
+    job->results = (int *)malloc(lane_ct * sizeof(int));
+    job->up_to_date = up_to_date;
+    memset(&job->stats, 0, sizeof(struct ww_stats));
+    if (stats_fd >= 0) clock_gettime(CLOCK_MONOTONIC, &job->start);
+    if (up_to_date) {
+        pthread_mutex_lock(&count_lock);
+        skipped_ct++;
+        pthread_mutex_unlock(&count_lock);
+        wrap_end(job, ctx);
+        return 0;
+    }
+    return 1;
+}
+
+int wrap_fd(struct wrap_job *job, int fd_in, struct ww_ctx *ctx)
+{
     int ret_value = 0;
-    if (written == -1) {
-        perror("ERROR: file write error");
+    struct stat in_stat;
+    int have_size = fstat(fd_in, &in_stat) == 0;
+    //create a temp file with all user permissions for each "wrap.filename";
+    //wrap_end puts it in place
+    for (; job->opened < job->lane_ct; job->opened++) {
+        if ((job->fd_out[job->opened] = temp_open(job->dir->fd, &job->tmp_names[job->opened],
+            job->file_names[job->opened])) < 0) {
+            perror("ERROR: file open error");
+            return -1;
+        }
+        if (have_size) out_prealloc(job->fd_out[job->opened], in_stat.st_size);
+        ww_set_lane_fd(ctx, job->opened, job->fd_out[job->opened]);
+    }
+    //process input file and output wrapped text to the "wrap." files
+    ctx->name = job->path;
+    stats_take(&job->stats, ctx);
+    if (ww_process_fd(ctx, fd_in) < 0) {
+        ret_value = -1;
+    }
+    stats_since(&job->stats, ctx);
+    for (int k = 0; k < job->lane_ct; k++) {
+        job->results[k] = ctx->lanes[k].result;
+    }
+    return ret_value;
+}
+
+/* wrap_file: wrap the entry name of dir->fd with the caller's wrapping context,
+ * reading and writing with blocking calls.
+ * Returns -1 if an error was reported for this entry, 0 otherwise
+ */
+int wrap_file(struct dir_ref *dir, const char *name, unsigned char d_type,
+    const struct stat *st, struct ww_ctx *ctx)
+{
+    struct wrap_job job;
+    int fd_in;
+    int ret_value;
+    if ((ret_value = wrap_begin(&job, dir, name, d_type, st, ctx)) <= 0) {
+        return ret_value;
+    }
+    //open read in file as current file/ check for errors
+    if ((fd_in = openat(dir->fd, name, O_RDONLY)) < 0) {
+        perror("ERROR: file open error");
         ret_value = -1;
     }
-    else if (written < requested) {
-        fprintf(stderr, "ERROR: tried to write %d bytes, only wrote %d\n",
-            requested, written);
+    else {
+        ret_value = wrap_fd(&job, fd_in, ctx);
+        close(fd_in);
+    }
+    if (wrap_end(&job, ctx) < 0) {
         ret_value = -1;
     }
     return ret_value;
 }
 
-/*  write_word: write the chars referenced by word to the file with file descriptor fd_out.
- *  Prepend newlines or space to the word based on whether
- *  a) the word is long enough to need a new line given the chars already written
- *     to the current line
- *  b) two or more newline chars were encountered prior to the word
- *  return values:
- *  2: new paragraph started with no errors
- *  1: newline started with no errors
- *  0: newline not started, no errors
- * -1: newline started with word length > column width
- * -2: error occurred upon call to write() or fewer bytes were written than requested 
+/* Worker pool for directory mode (-j N)
+ * The directory walk pushes eligible entries onto file_queue; each worker
+ * thread pops entries and calls wrap_file with its own ww_ctx, so no wrapping
+ * state is shared between threads.
+ * Only the queue, the dir_ref counts and fail_check are shared, all guarded by
+ * lock. Every error or alert message is written with a single stdio call
+ * (fprintf or perror), which locks stderr for the duration of the call, so
+ * lines from different workers never interleave.
  */
-int write_word(int fd_out, int col_width, int *line_char_ct, int newline_chars)
-{
-    char nl[2] = {'\n', '\n'};
-    char sp = ' ';
-    int newlines = 0;
-    int bytes_written = 0;
-    // if word has at least one char, write it to the output file
-    if (word_char_ct > 0) {
-        // determine how many newlines to prepend to the word
-        // 2 or more newlines implies a new paragraph
-        if (newline_chars > 1) {
-            newlines = 2;
-        }
-        // test against col_width to determine if the word is long enough to need
-        // a new line given the chars already written to the current line;
-        // add 1 char to account for prepended space
-        else if (*line_char_ct + 1 + word_char_ct > col_width) {
-            newlines = 1;
-        }
-        // write newlines and reset *line_char_ct if indicated
-        if (newlines > 0) {
-            bytes_written = write(fd_out, nl, newlines);
-            if (inform_write_err(newlines, bytes_written)) {
-                word_char_ct = 0;                
-                return -2;
-            }
-            *line_char_ct = 0;
-        } 
-        // write space and increment *line_char_ct if indicated
-        if (*line_char_ct > 0) {
-            bytes_written = write(fd_out, &sp, 1);
-            if (inform_write_err(1, bytes_written)) {
-                word_char_ct = 0;
-                return -2;
-            }
-            (*line_char_ct)++;
-        }
-        // write word to output file, increment *line_char_ct
-        bytes_written = write(fd_out, word, word_char_ct);
-        if (inform_write_err(word_char_ct, bytes_written)) {  
-            word_char_ct = 0;          
-            return -2;
+struct file_entry {
+    struct dir_ref *dir;
+    char *name;
+    unsigned char d_type;
+    // the stat the walk took of a regular file, if have_stat is set
+    struct stat st;
+    int have_stat;
+};
+
+struct file_queue {
+    struct file_entry *entries;
+    int cap;
+    int head;
+    int ct;
+    // set by main once the walk has returned every entry
+    int done;
+    int fail_check;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+void file_queue_init(struct file_queue *q, int cap)
+{
+    q->entries = malloc(sizeof(struct file_entry) * cap);
+    q->cap = cap;
+    q->head = 0;
+    q->ct = 0;
+    q->done = 0;
+    q->fail_check = EXIT_SUCCESS;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+void file_queue_destroy(struct file_queue *q)
+{
+    free(q->entries);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+// drop one reference to dir, closing it with the last one; q is NULL when
+// there are no workers
+void dir_release(struct file_queue *q, struct dir_ref *dir)
+{
+    int refs;
+    if (q) pthread_mutex_lock(&q->lock);
+    refs = --dir->refs;
+    if (q) pthread_mutex_unlock(&q->lock);
+    if (refs == 0) {
+        close(dir->fd);
+        free(dir->path);
+        free(dir);
+    }
+}
+
+// take one more reference to dir
+void dir_hold(struct file_queue *q, struct dir_ref *dir)
+{
+    if (q) pthread_mutex_lock(&q->lock);
+    dir->refs++;
+    if (q) pthread_mutex_unlock(&q->lock);
+}
+
+// add a copy of name in dir to q, waiting while q is full; the entry holds a
+// reference to dir until a worker is done with it
+void file_queue_push(struct file_queue *q, struct dir_ref *dir, const char *name,
+    unsigned char d_type, const struct stat *st)
+{
+    struct file_entry *e;
+    pthread_mutex_lock(&q->lock);
+    while (q->ct == q->cap) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    e = &q->entries[(q->head + q->ct) % q->cap];
+    e->dir = dir;
+    e->name = strdup(name);
+    e->d_type = d_type;
+    e->have_stat = st != NULL;
+    if (st) e->st = *st;
+    dir->refs++;
+    q->ct++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// tell the workers that no more entries are coming
+void file_queue_close(struct file_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->done = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// remove the oldest entry from q into *e, waiting while q is empty; returns 0
+// once q is empty and closed, 1 otherwise. The caller frees e->name and
+// releases e->dir
+int file_queue_pop(struct file_queue *q, struct file_entry *e)
+{
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    while (q->ct == 0 && !q->done) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->ct > 0) {
+        *e = q->entries[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->ct--;
+        found = 1;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+void *worker_main(void *arg)
+{
+    struct file_queue *q = arg;
+    struct ww_ctx ctx;
+    struct file_entry e;
+    ctx_init(&ctx);
+    while (file_queue_pop(q, &e)) {
+        if (wrap_file(e.dir, e.name, e.d_type, e.have_stat ? &e.st : NULL, &ctx) < 0) {
+            pthread_mutex_lock(&q->lock);
+            q->fail_check = EXIT_FAILURE;
+            pthread_mutex_unlock(&q->lock);
+        }
+        free(e.name);
+        dir_release(q, e.dir);
+    }
+    ww_destroy(&ctx);
+    return NULL;
+}
+
+/* io_uring backend (--uring)
+ * Without -j workers, the walk can hand regular files to an io_uring instead
+ * of wrapping each one with blocking calls. Up to URING_FILES files are in
+ * flight at once, each moving through these stages:
+ *   open the input -> read it whole -> open each output in turn -> wrap it in
+ *   memory -> write each output -> record and close
+ * The kernel opens and reads the next files while the current one is being
+ * wrapped, and the writes of all files in flight go out in batches, one
+ * io_uring_enter per round. Each output is written in exactly the chunks a
+ * blocking run would flush, one at a time, so a failing output stops where it
+ * would have and reports the same message. (All of a file is wrapped before
+ * its first write, so ALERTs for words after a failed write are still
+ * printed.) Inputs larger than URING_MAX_FILE, and compressed inputs, are
+ * wrapped with blocking calls instead, which bounds memory at about
+ * URING_FILES * URING_MAX_FILE plus the outputs. That happens after the
+ * completions at hand have been handled and the operations they queued have
+ * been submitted, so the other files' I/O goes on in the kernel meanwhile,
+ * but no completion is handled until the blocking file is done.
+ * The ring is driven with the raw system calls of <linux/io_uring.h>. If the
+ * kernel has no io_uring, or lacks the openat, read and write operations
+ * (Linux < 5.6), uring_start returns NULL and the blocking path is used.
+ */
+#ifdef WW_URING
+#define URING_FILES 16
+#define URING_MAX_FILE (1 << 20)
+
+enum {URING_OPEN_IN, URING_READ, URING_OPEN_OUT, URING_WRITE};
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+    // entries queued since the last io_uring_enter
+    unsigned to_submit;
+};
+
+// one output of a file on the ring: the chunks its lane flushed, written in
+// order starting at next
+struct uring_out {
+    char *data;
+    size_t ct;
+    size_t size;
+    int *chunk_len;
+    int chunk_ct;
+    int chunk_cap;
+    int next;
+    // bytes written so far, which is also the offset of chunk next
+    size_t done;
+};
+
+struct uring_file {
+    struct wrap_job job;
+    int in_use;
+    char *name;
+    int fd_in;
+    char *data;
+    size_t len;
+    size_t size;
+    // errno of a failed read, reported once the outputs are open
+    int read_errno;
+    // read operations completed
+    int reads;
+    // outputs with a write in flight
+    int writing;
+    int ret_value;
+    struct uring_out *out;
+    // a big or compressed input, left to uring_blocking
+    int blocking;
+};
+
+struct uring_engine {
+    struct uring ring;
+    struct ww_ctx *ctx;
+    struct uring_file files[URING_FILES];
+    int active;
+    // files waiting for uring_blocking
+    int blocking_ct;
+    int fail_check;
+};
+
+static int uring_setup(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    const int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE};
+    int supported = 1;
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) return -1;
+    probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        supported = 0;
+    }
+    for (int k = 0; supported && k < 3; k++) {
+        if (ops[k] > probe->last_op || !(probe->ops[ops[k]].flags & IO_URING_OP_SUPPORTED)) {
+            supported = 0;
+        }
+    }
+    free(probe);
+    if (!supported) {
+        close(r->fd);
+        return -1;
+    }
+    r->sq_entries = p.sq_entries;
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    // with a single mapping both rings live in the larger of the two sizes
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = 0;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = r->cq_map_size == 0 ? r->sq_map : mmap(NULL, r->cq_map_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_map_size);
+        if (r->cq_map_size && r->cq_map != MAP_FAILED) munmap(r->cq_map, r->cq_map_size);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+        close(r->fd);
+        return -1;
+    }
+    r->sq_head = (unsigned *)((char *)r->sq_map + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_map + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_map + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_map + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_map + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_map + p.cq_off.cqes);
+    r->to_submit = 0;
+    return 0;
+}
+
+static void uring_teardown(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_map_size) munmap(r->cq_map, r->cq_map_size);
+    munmap(r->sq_map, r->sq_map_size);
+    close(r->fd);
+}
+
+// submit the queued entries and, if wait is set, wait for one completion
+static void uring_enter(struct uring *r, int wait)
+{
+    int n;
+    do {
+        n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait ? 1 : 0,
+            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        // files in flight cannot be finished any other way
+        perror("ERROR: io_uring_enter");
+        exit(EXIT_FAILURE);
+    }
+    r->to_submit -= n;
+}
+
+// queue one operation; it is submitted by the next uring_enter
+static void uring_push(struct uring *r, int opcode, int fd, const void *addr,
+    unsigned len, unsigned long long off, unsigned open_flags, unsigned long long user_data)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned index;
+    struct io_uring_sqe *sqe;
+    // the kernel takes every queued entry at io_uring_enter
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+        uring_enter(r, 0);
+    }
+    index = tail & *r->sq_mask;
+    sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->open_flags = open_flags;
+    sqe->user_data = user_data;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+}
+
+// user_data of an operation: the file's slot, the stage and the output
+static unsigned long long uring_tag(int slot, int op, int lane)
+{
+    return (unsigned long long)slot | (unsigned long long)op << 8 |
+        (unsigned long long)lane << 16;
+}
+
+// ww_sink for a lane on the ring: keep each flush as a chunk to write later
+static ssize_t uring_collect(void *arg, const char *buf, size_t n)
+{
+    struct uring_out *o = arg;
+    while (o->ct + n > o->size) {
+        o->size = o->size ? o->size * 2 : WW_OUTBUFSIZE;
+        o->data = realloc(o->data, o->size * sizeof(char));
+    }
+    if (o->chunk_ct == o->chunk_cap) {
+        o->chunk_cap = o->chunk_cap ? o->chunk_cap * 2 : 16;
+        o->chunk_len = realloc(o->chunk_len, o->chunk_cap * sizeof(int));
+    }
+    memcpy(o->data + o->ct, buf, n);
+    o->ct += n;
+    o->chunk_len[o->chunk_ct++] = n;
+    return n;
+}
+
+static void uring_write_next(struct uring_engine *u, int slot, int lane)
+{
+    struct uring_file *f = &u->files[slot];
+    struct uring_out *o = &f->out[lane];
+    uring_push(&u->ring, IORING_OP_WRITE, f->job.fd_out[lane], o->data + o->done,
+        o->chunk_len[o->next], o->done, 0, uring_tag(slot, URING_WRITE, lane));
+}
+
+// create the temp file for the next output of the file in slot, as wrap_fd does
+static void uring_open_out(struct uring_engine *u, int slot)
+{
+    struct wrap_job *job = &u->files[slot].job;
+    int k = job->opened;
+    temp_name(&job->tmp_names[k], job->file_names[k]);
+    uring_push(&u->ring, IORING_OP_OPENAT, job->dir->fd, job->tmp_names[k], S_IRWXU, 0,
+        O_WRONLY | O_CREAT | O_EXCL, uring_tag(slot, URING_OPEN_OUT, k));
+}
+
+static void uring_file_done(struct uring_engine *u, int slot)
+{
+    struct uring_file *f = &u->files[slot];
+    if (wrap_end(&f->job, u->ctx) < 0 || f->ret_value < 0) {
+        u->fail_check = EXIT_FAILURE;
+    }
+    if (f->out) {
+        for (int k = 0; k < f->job.lane_ct; k++) {
+            free(f->out[k].data);
+            free(f->out[k].chunk_len);
+        }
+        free(f->out);
+    }
+    dir_release(NULL, f->job.dir);
+    free(f->data);
+    free(f->name);
+    f->in_use = 0;
+    u->active--;
+}
+
+// all outputs are open: wrap the input in memory, then start the writes
+static void uring_wrap(struct uring_engine *u, int slot)
+{
+    struct uring_file *f = &u->files[slot];
+    struct ww_ctx *ctx = u->ctx;
+    int lane_ct = f->job.lane_ct;
+    f->out = calloc(lane_ct, sizeof(struct uring_out));
+    for (int k = 0; k < lane_ct; k++) {
+        ww_set_lane_sink(ctx, k, uring_collect, &f->out[k]);
+    }
+    // same steps as ww_process_fd
+    ctx->name = f->job.path;
+    stats_take(&f->job.stats, ctx);
+    if (f->len > 0) ww_feed_input(ctx, f->data, f->len);
+    if (f->read_errno) {
+        errno = f->read_errno;
+        perror("ERROR: file read error");
+        ctx->return_value = -2;
+    }
+    if (ww_finish(ctx) < 0) f->ret_value = -1;
+    stats_since(&f->job.stats, ctx);
+    f->job.stats.reads = f->reads;
+    f->writing = 0;
+    for (int k = 0; k < lane_ct; k++) {
+        f->job.results[k] = ctx->lanes[k].result;
+        if (f->out[k].chunk_ct > 0) {
+            uring_write_next(u, slot, k);
+            f->writing++;
+        }
+    }
+    if (f->writing == 0) uring_file_done(u, slot);
+}
+
+static void uring_complete(struct uring_engine *u, unsigned long long user_data, int res)
+{
+    int slot = user_data & 0xff;
+    int op = (user_data >> 8) & 0xff;
+    int lane = user_data >> 16;
+    struct uring_file *f = &u->files[slot];
+    struct uring_out *o;
+    struct stat st;
+    switch (op) {
+    case URING_OPEN_IN:
+        if (res < 0) {
+            errno = -res;
+            perror("ERROR: file open error");
+            f->ret_value = -1;
+            uring_file_done(u, slot);
+            break;
+        }
+        f->fd_in = res;
+        // big inputs are wrapped with blocking calls, not held in memory whole
+        if (fstat(f->fd_in, &st) || st.st_size > URING_MAX_FILE) {
+            f->blocking = 1;
+            u->blocking_ct++;
+            break;
+        }
+        f->size = st.st_size + 1;
+        f->data = malloc(f->size * sizeof(char));
+        uring_push(&u->ring, IORING_OP_READ, f->fd_in, f->data, f->size, 0, 0,
+            uring_tag(slot, URING_READ, 0));
+        break;
+    case URING_READ:
+        f->reads++;
+        // compressed inputs are decompressed as they are read, with blocking
+        // calls, rather than held in memory whole
+        if (res > 0 && f->len == 0 && u->ctx->decompress && ww_format(f->data, res) != WW_PLAIN &&
+            lseek(f->fd_in, 0, SEEK_SET) == 0) {
+            f->blocking = 1;
+            u->blocking_ct++;
+            break;
+        }
+        if (res > 0) {
+            f->len += res;
+            // the file has grown since fstat
+            if (f->len == f->size) {
+                f->size *= 2;
+                f->data = realloc(f->data, f->size * sizeof(char));
+            }
+            uring_push(&u->ring, IORING_OP_READ, f->fd_in, f->data + f->len,
+                f->size - f->len, f->len, 0, uring_tag(slot, URING_READ, 0));
+            break;
+        }
+        if (res < 0) f->read_errno = -res;
+        close(f->fd_in);
+        uring_open_out(u, slot);
+        break;
+    case URING_OPEN_OUT:
+        // the temp name is taken; try another
+        if (res == -EEXIST) {
+            uring_open_out(u, slot);
+            break;
+        }
+        if (res < 0) {
+            errno = -res;
+            perror("ERROR: file open error");
+            f->ret_value = -1;
+            uring_file_done(u, slot);
+            break;
+        }
+        out_prealloc(res, f->len);
+        f->job.fd_out[f->job.opened++] = res;
+        if (f->job.opened < f->job.lane_ct) {
+            uring_open_out(u, slot);
+        }
+        else {
+            uring_wrap(u, slot);
+        }
+        break;
+    case URING_WRITE:
+        o = &f->out[lane];
+        // report failed and short writes like the blocking path, and stop there
+        if (res < 0) {
+            errno = -res;
+            perror("ERROR: file write error");
+        }
+        else if (res < o->chunk_len[o->next]) {
+            fprintf(stderr, "ERROR: tried to write %d bytes, only wrote %d\n",
+                o->chunk_len[o->next], res);
         }
         else {
-            *line_char_ct += bytes_written;
-            // get word as a string, for error messages
-            char *word_str = malloc(sizeof(char) * (word_char_ct + 1));
-            strncpy(word_str, word, word_char_ct);
-            word_str[word_char_ct] = '\0';
-            // return newlines unless word is longer than col_width
-            int return_val = newlines;
-            if (word_char_ct > col_width) {
-                fprintf(stderr, "\nALERT: Input contains '%s' with width %d, "
-                    "but column width is only %d\n", word_str, word_char_ct, col_width);
-                return_val = -1;
-            }
-            word_char_ct = 0;
-            free(word_str);
-            return return_val;
-        }
-    }
-    // if word has no chars, just return 0
+            o->done += res;
+            if (++o->next < o->chunk_ct) {
+                uring_write_next(u, slot, lane);
+                break;
+            }
+        }
+        if (o->next < o->chunk_ct) {
+            f->job.results[lane] = -2;
+            f->ret_value = -1;
+        }
+        if (--f->writing == 0) uring_file_done(u, slot);
+        break;
+    }
+}
+
+// wrap the files left for blocking calls, once every completion at hand has
+// been handled; what the others queued is submitted first, so that their I/O
+// goes on in the kernel meanwhile
+static void uring_blocking(struct uring_engine *u)
+{
+    if (u->ring.to_submit > 0) uring_enter(&u->ring, 0);
+    for (int slot = 0; slot < URING_FILES; slot++) {
+        struct uring_file *f = &u->files[slot];
+        if (!f->in_use || !f->blocking) continue;
+        f->ret_value = wrap_fd(&f->job, f->fd_in, u->ctx);
+        close(f->fd_in);
+        u->blocking_ct--;
+        uring_file_done(u, slot);
+    }
+}
+
+// submit what is queued and handle the completions that have arrived,
+// waiting for at least one if wait is set, then wrap the files left for
+// blocking calls
+static void uring_reap(struct uring_engine *u, int wait)
+{
+    struct uring *r = &u->ring;
+    unsigned head;
+    struct io_uring_cqe *cqe;
+    unsigned long long user_data;
+    int res;
+    uring_enter(r, wait);
+    head = *r->cq_head;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &r->cqes[head & *r->cq_mask];
+        user_data = cqe->user_data;
+        res = cqe->res;
+        __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+        uring_complete(u, user_data, res);
+    }
+    if (u->blocking_ct > 0) uring_blocking(u);
+}
+
+// set up the backend for files wrapped with ctx; NULL if io_uring is not usable
+struct uring_engine *uring_start(struct ww_ctx *ctx)
+{
+    struct uring_engine *u = calloc(1, sizeof(struct uring_engine));
+    // room for every operation that can be in flight: one per output of each file
+    if (uring_setup(&u->ring, URING_FILES * ctx->lane_ct)) {
+        free(u);
+        return NULL;
+    }
+    u->ctx = ctx;
+    u->fail_check = EXIT_SUCCESS;
+    return u;
+}
+
+// start wrapping the entry name of dir, waiting for a free slot first
+void uring_add(struct uring_engine *u, struct dir_ref *dir, const char *name,
+    unsigned char d_type, const struct stat *st)
+{
+    struct uring_file *f;
+    int slot = 0;
+    int result;
+    while (u->active == URING_FILES) {
+        uring_reap(u, 1);
+    }
+    while (u->files[slot].in_use) slot++;
+    f = &u->files[slot];
+    memset(f, 0, sizeof(struct uring_file));
+    f->name = strdup(name);
+    if ((result = wrap_begin(&f->job, dir, f->name, d_type, st, u->ctx)) <= 0) {
+        if (result < 0) u->fail_check = EXIT_FAILURE;
+        free(f->name);
+        return;
+    }
+    // the file keeps dir open until it is done
+    dir->refs++;
+    f->in_use = 1;
+    u->active++;
+    uring_push(&u->ring, IORING_OP_OPENAT, dir->fd, f->name, 0, 0, O_RDONLY,
+        uring_tag(slot, URING_OPEN_IN, 0));
+    uring_reap(u, 0);
+}
+
+// reap completions until every file in flight is done; u stays usable for
+// more files
+void uring_wait(struct uring_engine *u)
+{
+    while (u->active > 0) {
+        uring_reap(u, 1);
+    }
+}
+
+// finish every file in flight and free u; returns the status of its files
+int uring_finish(struct uring_engine *u)
+{
+    int fail_check;
+    uring_wait(u);
+    uring_teardown(&u->ring);
+    fail_check = u->fail_check;
+    free(u);
+    return fail_check;
+}
+#else
+struct uring_engine;
+struct uring_engine *uring_start(struct ww_ctx *ctx) { return NULL; }
+void uring_add(struct uring_engine *u, struct dir_ref *dir, const char *name,
+    unsigned char d_type, const struct stat *st) {}
+void uring_wait(struct uring_engine *u) {}
+int uring_finish(struct uring_engine *u) { return EXIT_SUCCESS; }
+#endif
+
+/* Directory walk
+ * walk_dir reads one directory with readdir and either wraps each eligible
+ * regular file itself (no workers) or queues it for the workers. Entries are
+ * handled as they are read, never collected first. With -r it descends into
+ * subdirectories as it meets them, opening each with openat relative to its
+ * parent, so no path is resolved twice and the process never changes its
+ * working directory. Symlinks to directories are not followed.
+ */
+struct dir_walk {
+    int recursive;
+    // q points at queue when there are workers, NULL otherwise
+    struct file_queue *q;
+    struct file_queue queue;
+    pthread_t *workers;
+    int jobs;
+    // context used when there are no workers
+    struct ww_ctx *ctx;
+    // io_uring backend wrapping with ctx, if --uring was given and it is usable
+    struct uring_engine *u;
+    int fail_check;
+    // parent directory of the last file named by walk_path, kept open for the
+    // next one since lists tend to name files of the same directory in a row
+    char *parent;
+    struct dir_ref *parent_dir;
+    // --watch: the inotify instance (-1 if not watching) and the directories
+    // it watches, sorted by watch descriptor; each holds a reference to its dir
+    int watch_fd;
+    struct watch *watches;
+    int watch_ct;
+    int watch_cap;
+};
+
+struct watch {
+    int wd;
+    struct dir_ref *dir;
+};
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+
+// index of the watch wd in w->watches, or where it would go as -1 - index
+int watch_find(struct dir_walk *w, int wd)
+{
+    int lo = 0, hi = w->watch_ct;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (w->watches[mid].wd == wd) return mid;
+        if (w->watches[mid].wd < wd) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1 - lo;
+}
+
+/* watch_add: start watching dir for files written or moved in (and, with -r,
+ * subdirectories created), through its descriptor so that a rename of the
+ * directory does not matter. Returns -1 if dir was already being watched,
+ * which means it has been walked already, 0 otherwise
+ */
+int watch_add(struct dir_walk *w, struct dir_ref *dir)
+{
+    char proc_path[64];
+    int wd, k;
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", dir->fd);
+    if ((wd = inotify_add_watch(w->watch_fd, proc_path, WATCH_MASK)) < 0 &&
+        (wd = inotify_add_watch(w->watch_fd, dir->path, WATCH_MASK)) < 0) {
+        fprintf(stderr, "ERROR: cannot watch %s: %s\n", dir->path, strerror(errno));
+        w->fail_check = EXIT_FAILURE;
+        return 0;
+    }
+    if ((k = watch_find(w, wd)) >= 0) return -1;
+    k = -1 - k;
+    if (w->watch_ct == w->watch_cap) {
+        w->watch_cap = w->watch_cap ? w->watch_cap * 2 : 16;
+        w->watches = realloc(w->watches, sizeof(struct watch) * w->watch_cap);
+    }
+    memmove(&w->watches[k + 1], &w->watches[k], sizeof(struct watch) * (w->watch_ct - k));
+    w->watches[k].wd = wd;
+    w->watches[k].dir = dir;
+    w->watch_ct++;
+    dir_hold(w->q, dir);
     return 0;
 }
 
-/* process_content: read the contents of the input file to buf and write words
- * to the output file as whitespace and non-whitespace chars are encountered.
- * fd_in and fd_out are the file descriptors of the input and output files,
- * which are assumed to be open already.
- * Returns 1 if all file operations completed successfully. If write_word returns
- * an error value (i.e. an int < 0), process_content returns that value. If a
- * read error occurs, process_content returns -2.
+// wrap the entry name of dir: hand it to a worker or the io_uring backend, or
+// wrap it right away. st is the stat of a regular file if the caller has one
+void walk_entry(struct dir_walk *w, struct dir_ref *dir, const char *name,
+    unsigned char d_type, const struct stat *st)
+{
+    if (w->q) {
+        file_queue_push(w->q, dir, name, d_type, st);
+    }
+    else if (w->u) {
+        uring_add(w->u, dir, name, d_type, st);
+    }
+    else if (wrap_file(dir, name, d_type, st, w->ctx) < 0) {
+        w->fail_check = EXIT_FAILURE;
+    }
+}
+
+// dir_path: a new string, path followed by name and a "/" if name is not empty
+// and path does not already end with one
+char *dir_path(const char *path, const char *name)
+{
+    int n = strlen(path);
+    char *dp = malloc(n + strlen(name) + 2);
+    strcpy(dp, path);
+    if (n > 0 && dp[n - 1] != '/') strcat(dp, "/");
+    strcat(dp, name);
+    if (name[0] != '\0') strcat(dp, "/");
+    return dp;
+}
+
+void walk_dir(struct dir_walk *w, int fd, char *path);
+
+// wrap every eligible entry of dir, descending into subdirectories with -r
+void walk_entries(struct dir_walk *w, struct dir_ref *dir)
+{
+    //declare local variables
+    const char *prefix = "wrap.";
+    char comp[6] = {'a', 'b', 'c', 'd', 'e'}; //set default comp array to ensure it does not equal "wrap."
+    DIR *dp;
+    struct dirent *de;
+    struct stat file_stat;
+    int have_stat;
+    unsigned char d_type;
+    int fd = dir->fd;
+    int sub_fd;
+    if ((dp = fdopendir(dup(fd))) == NULL) {
+        fprintf(stderr, "ERROR: %s\n", strerror(errno));
+        w->fail_check = EXIT_FAILURE;
+        return;
+    }
+    // a rescan must start from the first entry
+    rewinddir(dp);
+    //loop through directory
+    while ((de = readdir(dp)) != NULL) {
+        //bypass current directory indicator
+        if (!strcmp(de->d_name, "."))
+            continue;
+        //bypass parent directory indicator
+        if (!strcmp(de->d_name, ".."))    
+            continue;
+        //bypass file that starts with a "."
+        if (de->d_name[0] == '.')    
+            continue;
+        //bypass a file that starts with "wrap." and is not named "wrap.txt"
+        if(strlen(de->d_name) > 4){
+            for (int c = 0; c < 5; c++){
+                comp[c] = de->d_name[c];
+            }
+        }
+        if (!strcmp(comp, prefix))
+            continue;
+
+        d_type = de->d_type;
+        have_stat = 0;
+        if (w->recursive && d_type == DT_UNKNOWN) {
+            // the file system does not report types; look without following
+            // symlinks, and keep the stat of a regular file for wrap_begin
+            if (fstatat(fd, de->d_name, &file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+                if (S_ISDIR(file_stat.st_mode)) d_type = DT_DIR;
+                else if (S_ISREG(file_stat.st_mode)) have_stat = 1;
+                // neither a symlink nor a regular file: nothing to wrap
+                else if (!S_ISLNK(file_stat.st_mode)) continue;
+            }
+        }
+        //with -r, descend into subdirectories
+        if (w->recursive && d_type == DT_DIR) {
+            if ((sub_fd = openat(fd, de->d_name, O_RDONLY | O_DIRECTORY)) < 0) {
+                fprintf(stderr, "ERROR: %s: %s\n", de->d_name, strerror(errno));
+                w->fail_check = EXIT_FAILURE;
+            }
+            else {
+                walk_dir(w, sub_fd, dir_path(dir->path, de->d_name));
+            }
+        }
+        //directories are bypassed without a stat
+        else if (d_type == DT_DIR) {
+            continue;
+        }
+        else {
+            walk_entry(w, dir, de->d_name, d_type, have_stat ? &file_stat : NULL);
+        }
+    }
+    //close directory
+    closedir(dp);
+}
+
+// walk the directory open as fd; path is its name for --stats, and is freed
+// with its dir_ref
+void walk_dir(struct dir_walk *w, int fd, char *path)
+{
+    struct dir_ref *dir;
+    // the walk holds one reference to dir; queued entries hold the others
+    dir = malloc(sizeof(struct dir_ref));
+    dir->fd = fd;
+    dir->refs = 1;
+    dir->path = path;
+    // in watch mode, keep an eye on the directory before reading it, so no
+    // file can slip in between
+    if (w->watch_fd < 0 || watch_add(w, dir) == 0) {
+        walk_entries(w, dir);
+    }
+    dir_release(w->q, dir);
+}
+
+// set up w, starting jobs workers that wrap the files the walk finds if
+// jobs > 1; with no workers, files are wrapped with ctx as they are found,
+// on the io_uring backend if --uring was given
+void walk_start(struct dir_walk *w, struct ww_ctx *ctx, int recursive, int jobs)
+{
+    w->recursive = recursive;
+    w->q = NULL;
+    w->workers = NULL;
+    w->jobs = jobs;
+    w->ctx = ctx;
+    w->fail_check = EXIT_SUCCESS;
+    w->parent = NULL;
+    w->parent_dir = NULL;
+    w->u = NULL;
+    w->watch_fd = -1;
+    w->watches = NULL;
+    w->watch_ct = 0;
+    w->watch_cap = 0;
+    if (jobs <= 1 && use_uring) {
+        w->u = uring_start(ctx);
+    }
+    if (jobs > 1) {
+        file_queue_init(&w->queue, jobs * 4);
+        w->q = &w->queue;
+        w->workers = malloc(sizeof(pthread_t) * jobs);
+        for (int t = 0; t < jobs; t++) {
+            pthread_create(&w->workers[t], NULL, worker_main, w->q);
+        }
+    }
+}
+
+// wait for the workers to drain the queue and return the status of the walk
+int walk_finish(struct dir_walk *w)
+{
+    if (w->parent_dir) {
+        dir_release(w->q, w->parent_dir);
+        free(w->parent);
+    }
+    if (w->watch_fd >= 0) {
+        for (int k = 0; k < w->watch_ct; k++) {
+            dir_release(w->q, w->watches[k].dir);
+        }
+        free(w->watches);
+        close(w->watch_fd);
+    }
+    if (w->q) {
+        file_queue_close(w->q);
+        for (int t = 0; t < w->jobs; t++) {
+            pthread_join(w->workers[t], NULL);
+        }
+        if (w->q->fail_check == EXIT_FAILURE) {
+            w->fail_check = EXIT_FAILURE;
+        }
+        file_queue_destroy(w->q);
+        free(w->workers);
+    }
+    if (w->u && uring_finish(w->u) == EXIT_FAILURE) {
+        w->fail_check = EXIT_FAILURE;
+    }
+    if (incremental) {
+        fprintf(stderr, "ww: %d files wrapped, %d up to date\n",
+            wrapped_ct, skipped_ct);
+    }
+    return w->fail_check;
+}
+
+/* walk_path: handle one path given on the command line or by --files-from. A
+ * directory is walked as in directory mode; a regular file is wrapped into
+ * wrap.name next to it, unless its name is one the directory walk would skip
+ * (starting with "." or "wrap."), so that a shell glob over a directory
+ * leaves the outputs of an earlier run alone just like naming the directory.
  */
-int process_content(int fd_in, int fd_out, int col_width) {
-    char buf[BUFSIZE];
-    int bytes_read = 0;
-    int BOF = 1;
-    // keep track of how many chars (including whitespace) have been written to a line so far
-    int line_char_ct = 0;
-    int newline_chars = 0;
-    // need to remember how many newline chars precede the most recently completed word
-    int prev_newline_chars = 0;
-    int attempt_write = 0;
-    int write_result = 0;
-    int return_value = 1;
-
-    while ((bytes_read = read(fd_in, buf, BUFSIZE)) > 0) {
-        for (int i = 0; i < bytes_read; i++) {
-            // ignore any whitespace at the beginning of the input file
-            if (isspace(buf[i]) && !BOF) {
-                // write the contents of word to the output file as soon as the next
-                // non-whitespace char is encountered; this ensures that all newline
-                // chars are counted before writing the word, which in turn ensures
-                // correct paragraph formatting
-                attempt_write = 1;
-                if (buf[i] == '\n') newline_chars++;
-            }
-            else if (!isspace(buf[i])) {
-                BOF = 0;
-                if (attempt_write) {
-                    write_result = write_word(fd_out, col_width, &line_char_ct,
-                        prev_newline_chars);
-                    // stop process_content if write_word returns an error value of -2
-                    if (write_result == -2) {
-                        return -2;
-                    }
-                    // set return_value if write_word returns an error value of -1,
-                    // but continue process_content
-                    else if (write_result == -1) {
-                        return_value = write_result;
-                    }
-                    attempt_write = 0;
-                    prev_newline_chars = newline_chars;
-                    newline_chars = 0;
-                }
-                add_char(buf[i]);
+void walk_path(struct dir_walk *w, const char *path)
+{
+    struct stat path_stat;
+    const char *slash, *name;
+    int fd;
+    if (stat(path, &path_stat)) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        w->fail_check = EXIT_FAILURE;
+    }
+    else if (S_ISDIR(path_stat.st_mode)) {
+        if ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+            fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+            w->fail_check = EXIT_FAILURE;
+        }
+        else {
+            walk_dir(w, fd, dir_path(path, ""));
+        }
+    }
+    else if (S_ISREG(path_stat.st_mode)) {
+        slash = strrchr(path, '/');
+        name = slash ? slash + 1 : path;
+        if (name[0] == '.' || !strncmp(name, "wrap.", 5)) return;
+        // open the parent directory unless the last file was in it too
+        if (w->parent_dir == NULL || strncmp(w->parent, path, name - path) ||
+            w->parent[name - path] != '\0') {
+            if (w->parent_dir) {
+                dir_release(w->q, w->parent_dir);
+                free(w->parent);
+                w->parent_dir = NULL;
+            }
+            w->parent = slash ? strndup(path, name - path) : strdup("");
+            if ((fd = open(slash ? w->parent : ".", O_RDONLY | O_DIRECTORY)) < 0) {
+                fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+                w->fail_check = EXIT_FAILURE;
+                free(w->parent);
+                return;
             }
+            w->parent_dir = malloc(sizeof(struct dir_ref));
+            w->parent_dir->fd = fd;
+            w->parent_dir->refs = 1;
+            w->parent_dir->path = strdup(w->parent);
         }
+        walk_entry(w, w->parent_dir, name, DT_REG, &path_stat);
     }
-    // inform of read errors
-    if (bytes_read < 0) {
-        perror("ERROR: file read error");
-        return_value = -2;
+    else {
+        fprintf(stderr, "ERROR: %s is not a valid file or directory\n", path);
+        w->fail_check = EXIT_FAILURE;
+    }
+}
+
+// walk every path listed in the file list_name ("-" for stdin), separated by
+// delim; returns -1 if the list cannot be read
+int walk_list(struct dir_walk *w, const char *list_name, int delim)
+{
+    FILE *fp = strcmp(list_name, "-") ? fopen(list_name, "r") : stdin;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    int ret_value = 0;
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", list_name, strerror(errno));
+        return -1;
+    }
+    while ((n = getdelim(&line, &size, delim, fp)) > 0) {
+        if (line[n - 1] == delim) line[--n] = '\0';
+        if (n > 0) walk_path(w, line);
     }
-    // attempt one final write    
-    if ((write_result = write_word(fd_out, col_width, &line_char_ct,
-        prev_newline_chars)) < 0) {
-        return_value = write_result;
+    if (ferror(fp)) {
+        fprintf(stderr, "ERROR: %s: %s\n", list_name, strerror(errno));
+        ret_value = -1;
     }
-    // need to terminate output with a newline unless the input file had no words
-    if (!BOF) {
-        char nl = '\n';
-        write(fd_out, &nl, 1);
-    }    
-    return return_value;
+    free(line);
+    if (fp != stdin) fclose(fp);
+    return ret_value;
+}
+
+/* Watch mode (--watch)
+ * Once the paths on the command line are done, ww keeps running and wraps
+ * whatever is written into the directories it walked. A file is taken when its
+ * writer closes it (IN_CLOSE_WRITE), so a file is never wrapped half written,
+ * or when it is moved in whole (IN_MOVED_TO). The skip rules are those of the
+ * walk, and ww's own temp files, records and wrap.* outputs match them, so
+ * they never set it off. Events for the same file read in one batch are
+ * handled once. With -r, new subdirectories are walked and watched as well.
+ * If the kernel's event queue overflows, every watched directory is read
+ * again. Memory grows only with the number of watched directories. SIGINT or
+ * SIGTERM ends the run normally, with the --incremental and --stats summaries.
+ */
+#define WATCH_BUFSIZE 65536
+
+// the walk's skip rule, for names reported by events
+int watch_skip(const char *name)
+{
+    return name[0] == '.' || !strncmp(name, "wrap.", 5);
+}
+
+// read every watched directory again, after events were lost
+void watch_rescan(struct dir_walk *w)
+{
+    int ct = w->watch_ct;
+    struct dir_ref **dirs = malloc(sizeof(struct dir_ref *) * ct);
+    // the rescan may add and drop watches, so hold on to the directories
+    for (int k = 0; k < ct; k++) {
+        dirs[k] = w->watches[k].dir;
+        dir_hold(w->q, dirs[k]);
+    }
+    for (int k = 0; k < ct; k++) {
+        walk_entries(w, dirs[k]);
+        dir_release(w->q, dirs[k]);
+    }
+    free(dirs);
+}
+
+/* watch_event: act on the event ev, which was read in the batch starting at
+ * first
+ */
+void watch_event(struct dir_walk *w, const struct inotify_event *ev, const char *first)
+{
+    const struct inotify_event *prev;
+    struct dir_ref *dir;
+    int k, sub_fd;
+    if (ev->mask & IN_Q_OVERFLOW) {
+        fprintf(stderr, "ww: inotify event queue overflowed, rescanning\n");
+        watch_rescan(w);
+        return;
+    }
+    if ((k = watch_find(w, ev->wd)) < 0) return;
+    dir = w->watches[k].dir;
+    // the directory is gone
+    if (ev->mask & IN_IGNORED) {
+        memmove(&w->watches[k], &w->watches[k + 1], sizeof(struct watch) * (w->watch_ct - k - 1));
+        w->watch_ct--;
+        dir_release(w->q, dir);
+        return;
+    }
+    if (ev->len == 0 || watch_skip(ev->name)) return;
+    if (ev->mask & IN_ISDIR) {
+        if (w->recursive && (sub_fd = openat(dir->fd, ev->name,
+            O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) >= 0) {
+            walk_dir(w, sub_fd, dir_path(dir->path, ev->name));
+        }
+        return;
+    }
+    // a new file is taken once it is closed
+    if (!(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) return;
+    for (const char *p = first; p < (const char *)ev;
+        p += sizeof(struct inotify_event) + prev->len) {
+        prev = (const struct inotify_event *)p;
+        if (prev->wd == ev->wd && (prev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+            !(prev->mask & IN_ISDIR) && prev->len > 0 && !strcmp(prev->name, ev->name)) {
+            return;
+        }
+    }
+    walk_entry(w, dir, ev->name, DT_UNKNOWN, NULL);
+}
+
+// handle events on the watched directories until a signal arrives on signal_fd
+void walk_watch(struct dir_walk *w, int signal_fd)
+{
+    char *buf;
+    const struct inotify_event *ev;
+    struct pollfd fds[2] = {{w->watch_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+    ssize_t n;
+    if (w->watch_ct == 0) {
+        fprintf(stderr, "ERROR: --watch found no directory to watch\n");
+        w->fail_check = EXIT_FAILURE;
+        return;
+    }
+    buf = malloc(WATCH_BUFSIZE);
+    for (;;) {
+        // finish the files in flight before waiting for more
+        if (w->u) uring_wait(w->u);
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("ERROR: poll");
+            w->fail_check = EXIT_FAILURE;
+            break;
+        }
+        if (fds[1].revents) break;
+        if ((n = read(w->watch_fd, buf, WATCH_BUFSIZE)) <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            perror("ERROR: inotify read error");
+            w->fail_check = EXIT_FAILURE;
+            break;
+        }
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            watch_event(w, ev, buf);
+        }
+    }
+    free(buf);
 }
 
 int main(int argc, char **argv) {
     int fd_in, fd_out;
-    int col_width;
+    const char *c;
     int fail_check = EXIT_SUCCESS;
     struct stat argv_stat;
-    word = malloc(sizeof(char) * WORDSIZE_INIT);
+    struct ww_ctx ctx;
+    int jobs = 0;
+    int split = 0;
+    int recursive = 0;
+    int argi = 1;
+    const char *scanner_name = NULL;
+    const char *files_from = NULL;
+    int list_delim = '\n';
+    struct ww_stats file_stats;
+    int result;
+    int watch = 0;
+    int signal_fd = -1;
+    sigset_t signals;
+    // options come before col_width
+    while (argi < argc && (!strncmp(argv[argi], "--", 2) || !strncmp(argv[argi], "-j", 2) ||
+        !strcmp(argv[argi], "-r") || !strcmp(argv[argi], "-0"))) {
+        if (!strcmp(argv[argi], "--bufsize") && argi + 1 < argc) {
+            read_bufsize = atoi(argv[argi + 1]);
+            if (read_bufsize < 1) {
+                fprintf(stderr, "--bufsize must be a positive integer\n");
+                exit(EXIT_FAILURE);
+            }
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--mmap")) {
+            use_mmap = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--no-decompress")) {
+            decompress = 0;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "-r")) {
+            recursive = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--incremental")) {
+            incremental = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--uring")) {
+            use_uring = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--optimal")) {
+            optimal = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--utf8")) {
+            utf8 = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--files-from") && argi + 1 < argc) {
+            files_from = argv[argi + 1];
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "-0")) {
+            list_delim = '\0';
+            argi++;
+        }
+        else if ((!strcmp(argv[argi], "--stats") || !strcmp(argv[argi], "--stats-json")) &&
+            argi + 1 < argc) {
+            stats_json = !strcmp(argv[argi], "--stats-json");
+            stats_fd = atoi(argv[argi + 1]);
+            if (fcntl(stats_fd, F_GETFD) < 0) {
+                fprintf(stderr, "ERROR: %s %s: %s\n", argv[argi], argv[argi + 1],
+                    strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--max-alerts") && argi + 1 < argc) {
+            max_alerts = atoi(argv[argi + 1]);
+            if (max_alerts < 0 || !isdigit((unsigned char)argv[argi + 1][0])) {
+                fprintf(stderr, "--max-alerts must be a non-negative integer\n");
+                exit(EXIT_FAILURE);
+            }
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--compress") && argi + 1 < argc) {
+            if (!strcmp(argv[argi + 1], "gzip")) {
+                compress_out = WW_GZIP;
+                compress_suffix = ".gz";
+            }
+            else if (!strcmp(argv[argi + 1], "zstd")) {
+#ifndef HAVE_ZSTD
+                fprintf(stderr, "ERROR: this ww was built without zstd (make ZSTD=1)\n");
+                exit(EXIT_FAILURE);
+#endif
+                compress_out = WW_ZSTD;
+                compress_suffix = ".zst";
+            }
+            else {
+                fprintf(stderr, "--compress must be gzip or zstd\n");
+                exit(EXIT_FAILURE);
+            }
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--watch")) {
+            watch = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--quiet")) {
+            quiet_alerts = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--split")) {
+            split = 1;
+            argi++;
+        }
+        else if (!strcmp(argv[argi], "--scanner") && argi + 1 < argc) {
+            scanner_name = argv[argi + 1];
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--outbufsize") && argi + 1 < argc) {
+            outbuf_size = atoi(argv[argi + 1]);
+            if (outbuf_size < 1) {
+                fprintf(stderr, "--outbufsize must be a positive integer\n");
+                exit(EXIT_FAILURE);
+            }
+            argi += 2;
+        }
+        else if (!strncmp(argv[argi], "-j", 2) && (argv[argi][2] || argi + 1 < argc)) {
+            // accept both "-j N" and "-jN"
+            if (argv[argi][2]) {
+                jobs = atoi(argv[argi] + 2);
+                argi++;
+            }
+            else {
+                jobs = atoi(argv[argi + 1]);
+                argi += 2;
+            }
+            if (jobs < 1) {
+                fprintf(stderr, "-j must be a positive integer\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            fprintf(stderr, "ERROR: unknown option %s\n", argv[argi]);
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (ww_set_scanner(scanner_name)) {
+        fprintf(stderr, "ERROR: scanner %s is not supported on this CPU\n", scanner_name);
+        exit(EXIT_FAILURE);
+    }
+    // one job unless -j says otherwise; --split defaults to one per CPU
+    if (jobs == 0) {
+        jobs = split ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        if (jobs < 1) jobs = 1;
+    }
+    // shift past the options so col_width is argv[1] again
+    argc -= argi - 1;
+    argv += argi - 1;
     // open input and output files
     if (argc < 2) {
-        fprintf(stderr, "usage: ./ww col_width [filename | dirname]\n");
+        fprintf(stderr, USAGE);
         fail_check = EXIT_FAILURE;
     }
     else {
-        col_width = atoi(argv[1]);
-        if (col_width < 1) {
-            fprintf(stderr, "usage: ./ww col_width [filename | dirname]\n");
-            fprintf(stderr, "col_width must be a positive integer\n");
-            free(word);
-            exit(EXIT_FAILURE);
+        // col_width may be a comma-separated list of widths
+        widths = (int *)malloc((strlen(argv[1]) + 1) * sizeof(int));
+        for (c = argv[1]; ; c++) {
+            widths[width_ct] = atoi(c);
+            if (widths[width_ct] < 1) {
+                fprintf(stderr, USAGE);
+                fprintf(stderr, "col_width must be a positive integer\n");
+                exit(EXIT_FAILURE);
+            }
+            for (int k = 0; k < width_ct; k++) {
+                if (widths[k] == widths[width_ct]) {
+                    fprintf(stderr, "ERROR: col_width %d given twice\n", widths[k]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            width_ct++;
+            if ((c = strchr(c, ',')) == NULL) break;
+        }
+        ctx_init(&ctx);
+        if (stats_fd >= 0) stats_start();
+        // several widths need somewhere to put wrap.<width>.name
+        if (argc == 2 && !files_from && width_ct > 1) {
+            fprintf(stderr, "ERROR: several column widths need a file or directory name\n");
+            fail_check = EXIT_FAILURE;
+        }
+        // stdin and a single file wrap to stdout, which --watch cannot keep
+        // up to date
+        else if (watch && !files_from && (argc == 2 || (argc == 3 && width_ct == 1 &&
+            stat(argv[2], &argv_stat) == 0 && S_ISREG(argv_stat.st_mode)))) {
+            fprintf(stderr, "ERROR: --watch needs a directory to watch\n");
+            fprintf(stderr, USAGE);
+            fail_check = EXIT_FAILURE;
         }
         // if no filename is provided, use stdin for input
-        if (argc == 2) {
+        else if (argc == 2 && !files_from) {
             fd_in = STDIN_FILENO;
             fd_out = STDOUT_FILENO;
-            if(process_content(fd_in, fd_out, col_width) <0){
+            ww_set_fd(&ctx, fd_out);
+            stats_take(&file_stats, &ctx);
+            if((result = ww_process_fd(&ctx, fd_in)) <0){
                 fail_check = EXIT_FAILURE;
             }
+            stats_since(&file_stats, &ctx);
+            stats_file("-", &file_stats, seconds_since(&run_stats.start), result);
             // close files as needed
             close(fd_in); 
             close(fd_out);
         }
-        else {
-            //make sure argv[2] is a valid file or directory
-            if (stat(argv[2], &argv_stat)){
-                fprintf(stderr, "ERROR: %s\n", strerror(errno));
-                free(word);
+        //a single regular file at a single width is wrapped to stdout
+        else if (argc == 3 && !files_from && width_ct == 1 &&
+            stat(argv[2], &argv_stat) == 0 && S_ISREG(argv_stat.st_mode)) {
+            if ((fd_in = open(argv[2], O_RDONLY)) < 0) {
+                perror("ERROR: file open error");
+                memset(&file_stats, 0, sizeof(struct ww_stats));
+                stats_file(argv[2], &file_stats, seconds_since(&run_stats.start), -2);
+                stats_finish();
+                ww_destroy(&ctx);
                 exit(EXIT_FAILURE);
             }
-            //if argv[2] is a directory type loop through directory and process each file
-            if(S_ISDIR(argv_stat.st_mode)){
-                //declare local variables
-                const char *prefix = "wrap.";
-                char comp[6] = {'a', 'b', 'c', 'd', 'e'}; //set default comp array to ensure it does not equal "wrap."
-                int n;
-                char *file_name;
-                DIR *dp;
-                struct dirent *de;
-                struct stat file_stat;
-                dp = opendir(argv[2]);
-                //if chdir() does not return an error change working directory to given directory, else exit program
-                if((chdir(argv[2])) == -1){
-                    fprintf(stderr, "ERROR: %s\n", strerror(errno));
-                    free(word);
-                    exit(EXIT_FAILURE);
-                }    
-                //loop through directory
-                while ((de = readdir(dp)) != NULL) {
-                    //bypass current directory indicator
-                    if (!strcmp(de->d_name, "."))
-                        continue;
-                    //bypass parent directory indicator
-                    if (!strcmp(de->d_name, ".."))    
-                        continue;
-                    //bypass file that starts with a "."
-                    if (de->d_name[0] == '.')    
-                        continue;
-                    //bypass a file that starts with "wrap." and is not named "wrap.txt"
-                    if(strlen(de->d_name) > 4){
-                        for (int c = 0; c < 5; c++){
-                            comp[c] = de->d_name[c];
-                        }
-                    }
-                    if (!strcmp(comp, prefix))
-                        continue;
-                    
-                    //make sure stat returns no errors
-                    if (stat(de->d_name, &file_stat)){
-                        fprintf(stderr, "ERROR: stat(%s): %s\n", de->d_name, strerror(errno));
-                        fail_check = EXIT_FAILURE;
-                        continue;
-                    }
-                    //if current file is a regular file
-                    if(S_ISREG(file_stat.st_mode)){
-                        //open read in file as current file/ check for errors
-                        if ((fd_in = open(de->d_name, O_RDONLY)) < 0) {
-                            perror("ERROR: file open error");
-                            fail_check = EXIT_FAILURE;
-                            continue;
-                        }
-                        //get total number of characters for wrapped file name
-                        n = strlen(de->d_name) + strlen(prefix) + 1;
-                        //initialize arrayList to file_name pointer
-                        file_name = (char *)malloc(n * sizeof(char));
-                        //copy prefix to file_name then append current file name to file_name
-                        strcpy(file_name, prefix );             
-                        strcat(file_name, de->d_name);
-                        //create new file as "wrap.filename" with all user permissions
-                        //if file exists, overwrite it
-                        if((fd_out = open(file_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU)) < 0){
-                            perror("ERROR: file open error");
-                            close(fd_in);
-                            free(file_name);
-                            fail_check = EXIT_FAILURE;
-                            continue;
-                        }
-                        //process input file and output wrapped text to "wrap." file
-                        if(process_content(fd_in, fd_out, col_width) < 0){
-                            close(fd_in);
-                            close(fd_out);
-                            free(file_name);
-                            fail_check = EXIT_FAILURE;                     
-                            continue;
-                        }
-                        //close open files
-                        close(fd_in);
-                        close(fd_out);
-                        //free memory allocated by malloc
-                        free(file_name);
-                    }
-                }
-                //close directory
-                closedir(dp);
-            }
-            //argv[2] is a regular file type
-            else if(S_ISREG(argv_stat.st_mode)){
-                if ((fd_in = open(argv[2], O_RDONLY)) < 0) {
-                    perror("ERROR: file open error");
-                    free(word);
-                    exit(EXIT_FAILURE);
-                }
-                fd_out = STDOUT_FILENO;
-                if(process_content(fd_in, fd_out, col_width) < 0){
-                    close(fd_in); 
-                    close(fd_out);
-                    free(word);
-                    exit(EXIT_FAILURE);
-                }
+            fd_out = STDOUT_FILENO;
+            ww_set_fd(&ctx, fd_out);
+            ctx.name = argv[2];
+            stats_take(&file_stats, &ctx);
+            result = split ? ww_process_split(&ctx, fd_in, jobs) : ww_process_fd(&ctx, fd_in);
+            stats_since(&file_stats, &ctx);
+            stats_file(argv[2], &file_stats, seconds_since(&run_stats.start), result);
+            if(result < 0){
                 close(fd_in); 
                 close(fd_out);
+                stats_finish();
+                ww_destroy(&ctx);
+                exit(EXIT_FAILURE);
             }
-            //if arg[2] is anything other then a directory or regular file print error and exit program
-            else{
-                fprintf(stderr, "ERROR: argv[2] is not a valid file or directory\n");
-                fail_check = EXIT_FAILURE;
+            close(fd_in); 
+            close(fd_out);
+        }
+        //directories, several files or widths, and --files-from: wrap every
+        //regular file into wrap.filename next to it, sharing ctx (or the
+        //-j workers) across all of them
+        else {
+            struct dir_walk w;
+            // in watch mode the signals that end the run are taken from
+            // signal_fd; block them before the workers start so that none of
+            // them gets one
+            if (watch) {
+                sigemptyset(&signals);
+                sigaddset(&signals, SIGINT);
+                sigaddset(&signals, SIGTERM);
+                pthread_sigmask(SIG_BLOCK, &signals, NULL);
+                signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+            }
+            walk_start(&w, &ctx, recursive, jobs);
+            if (watch && (w.watch_fd = inotify_init1(IN_CLOEXEC)) < 0) {
+                perror("ERROR: inotify_init1");
+                w.fail_check = EXIT_FAILURE;
+            }
+            for (int a = 2; a < argc; a++) {
+                walk_path(&w, argv[a]);
+            }
+            if (files_from && walk_list(&w, files_from, list_delim)) {
+                w.fail_check = EXIT_FAILURE;
+            }
+            if (w.watch_fd >= 0) {
+                walk_watch(&w, signal_fd);
+                close(signal_fd);
             }
+            fail_check = walk_finish(&w);
         }
+        stats_finish();
+        // free memory
+        ww_destroy(&ctx);
+        free(widths);
     }
-    // free memory
-    free(word);
     return fail_check;
 }
\ No newline at end of file